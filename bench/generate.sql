@@ -0,0 +1,125 @@
+--
+-- Synthetic history generator for the restore benchmark, see run.sh
+--
+-- Creates the table bench_orig, logged by table_log into bench_orig_log
+-- (level 5), and fills the log table directly with a synthetic but
+-- consistent history:
+--
+--   :rows     number of changes (INSERT, UPDATE or DELETE)
+--   :keys     number of distinct keys
+--   :del_pct  percentage of changes after a key's first INSERT which
+--             are DELETEs, each followed by a new INSERT of the key
+--   :skew     key skew, 1 is uniform, higher values concentrate the
+--             changes on few keys
+--   :width    width of the payload column in bytes
+--   :batch    number of changes generated per statement
+--
+-- bench_orig is set to the final state of the history afterwards.
+-- Needs PostgreSQL 11 or later, since every batch is committed.
+-- The log is written at one change per millisecond, ending now.
+--
+
+\set ON_ERROR_STOP 1
+
+DROP TABLE IF EXISTS bench_orig, bench_orig_log, bench_keys;
+DROP SEQUENCE IF EXISTS bench_orig_log_seq;
+
+CREATE TABLE bench_orig (id BIGINT PRIMARY KEY, payload TEXT NOT NULL);
+SELECT table_log_init(5, 'bench_orig');
+
+-- the state of each key at the end of the history generated so far
+CREATE UNLOGGED TABLE bench_keys (
+    k            BIGINT  PRIMARY KEY,
+    version      BIGINT  NOT NULL,
+    last_deleted BOOLEAN NOT NULL
+);
+
+-- the row image of version v of key k
+CREATE OR REPLACE FUNCTION bench_payload(k BIGINT, v BIGINT, width INT)
+RETURNS TEXT AS $$
+    SELECT left(repeat(md5(k::text || ':' || v::text), (width + 31) / 32), width);
+$$ LANGUAGE sql IMMUTABLE;
+
+CREATE OR REPLACE PROCEDURE bench_generate(num_rows BIGINT, num_keys BIGINT, del_pct FLOAT8,
+                                           skew FLOAT8, width INT, batch BIGINT)
+AS $$
+DECLARE
+    base TIMESTAMPTZ := now() - (num_rows + 1) * interval '1 millisecond';
+    lo   BIGINT      := 1;
+    hi   BIGINT;
+BEGIN
+    WHILE lo <= num_rows LOOP
+        hi := least(lo + batch - 1, num_rows);
+
+        --
+        -- Each change gets a key and the next version number of that
+        -- key. Versions start with an INSERT, even versions may be a
+        -- DELETE, and the version after a DELETE is an INSERT again.
+        -- This keeps the history consistent without replaying it.
+        --
+        CREATE TEMP TABLE bench_batch AS
+        WITH ev AS (
+            SELECT s AS seq,
+                   1 + least(floor(num_keys * power(random(), skew)), num_keys - 1)::bigint AS k,
+                   random() * 100 < del_pct AS c
+              FROM generate_series(lo, hi) s
+        ), num AS (
+            SELECT ev.*,
+                   row_number() OVER w AS rn,
+                   lag(c) OVER w AS prev_c
+              FROM ev
+            WINDOW w AS (PARTITION BY k ORDER BY seq)
+        ), st AS (
+            SELECT num.seq, num.k, num.c,
+                   coalesce(ks.version, 0) + num.rn AS v,
+                   CASE WHEN num.rn = 1 THEN coalesce(ks.last_deleted, false)
+                        ELSE (coalesce(ks.version, 0) + num.rn - 1) % 2 = 0 AND num.prev_c
+                   END AS prev_deleted
+              FROM num LEFT JOIN bench_keys ks ON ks.k = num.k
+        )
+        SELECT seq, k, v,
+               CASE WHEN v = 1 OR prev_deleted THEN 'INSERT'
+                    WHEN v % 2 = 0 AND c THEN 'DELETE'
+                    ELSE 'UPDATE'
+               END AS op
+          FROM st;
+
+        INSERT INTO bench_orig_log (id, payload, trigger_mode, trigger_tuple,
+                                    trigger_changed, trigger_id, trigger_user)
+        SELECT b.k, bench_payload(b.k, t.v, width), b.op, t.tuple,
+               base + b.seq * interval '1 millisecond',
+               b.seq * 2 + (t.tuple = 'new')::int, current_user
+          FROM bench_batch b,
+               LATERAL (VALUES ('old', b.v - 1), ('new', b.v)) AS t(tuple, v)
+         WHERE (t.tuple = 'old' AND b.op IN ('UPDATE', 'DELETE'))
+            OR (t.tuple = 'new' AND b.op IN ('INSERT', 'UPDATE'));
+
+        INSERT INTO bench_keys
+        SELECT DISTINCT ON (k) k, v, op = 'DELETE'
+          FROM bench_batch
+         ORDER BY k, seq DESC
+            ON CONFLICT (k) DO UPDATE
+           SET version = excluded.version, last_deleted = excluded.last_deleted;
+
+        DROP TABLE bench_batch;
+        COMMIT;
+
+        RAISE NOTICE 'generated % of % changes', hi, num_rows;
+        lo := hi + 1;
+    END LOOP;
+END;
+$$ LANGUAGE plpgsql;
+
+CALL bench_generate(:rows, :keys, :del_pct, :skew, :width, :batch);
+
+-- the final state, without logging it again
+ALTER TABLE bench_orig DISABLE TRIGGER USER;
+INSERT INTO bench_orig
+SELECT k, bench_payload(k, version, :width) FROM bench_keys WHERE NOT last_deleted;
+ALTER TABLE bench_orig ENABLE TRIGGER USER;
+
+SELECT setval('bench_orig_log_seq', (SELECT max(trigger_id) FROM bench_orig_log));
+
+DROP TABLE bench_keys;
+VACUUM ANALYZE bench_orig;
+VACUUM ANALYZE bench_orig_log;
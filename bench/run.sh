@@ -0,0 +1,113 @@
+#!/bin/sh
+#
+# Restore benchmark for table_log
+#
+# Generates a synthetic history (see generate.sql) and times
+# table_log_restore_table() restoring forward, backward and a single
+# key at several points of the history. For each restore it reports
+# the number of log entries in the replayed range, the elapsed time,
+# the rate in log entries per second and the peak memory (VmHWM) of
+# the backend.
+#
+# Usage: bench/run.sh [options]
+#
+#   -d dbname     database to use (default: $PGDATABASE)
+#   -r rows       number of changes in the history (default: 1000000)
+#   -k keys       number of distinct keys (default: 100000)
+#   -x del_pct    percentage of DELETEs (default: 10)
+#   -s skew       key skew, 1 is uniform (default: 1)
+#   -w width      payload width in bytes (default: 100)
+#   -b batch      changes generated per statement (default: 1000000)
+#   -t targets    points of the history to restore, as fractions
+#                 (default: "0.25 0.5 0.75")
+#   -n            don't generate, reuse the existing history
+#
+# The database needs the table_log extension. Peak memory is read from
+# /proc/self/status of the backend, so it is only reported on Linux and
+# when running as superuser; otherwise it is shown as "-". Needs psql
+# and PostgreSQL 11 or later.
+#
+
+set -e
+
+DB="${PGDATABASE:-}"
+ROWS=1000000
+KEYS=100000
+DEL_PCT=10
+SKEW=1
+WIDTH=100
+BATCH=1000000
+TARGETS="0.25 0.5 0.75"
+GENERATE=1
+
+while getopts "d:r:k:x:s:w:b:t:n" opt; do
+	case "$opt" in
+		d) DB="$OPTARG" ;;
+		r) ROWS="$OPTARG" ;;
+		k) KEYS="$OPTARG" ;;
+		x) DEL_PCT="$OPTARG" ;;
+		s) SKEW="$OPTARG" ;;
+		w) WIDTH="$OPTARG" ;;
+		b) BATCH="$OPTARG" ;;
+		t) TARGETS="$OPTARG" ;;
+		n) GENERATE=0 ;;
+		*) sed -n '2,/^$/s/^# \{0,1\}//p' "$0"; exit 1 ;;
+	esac
+done
+
+BENCH_DIR=$(dirname "$0")
+PSQL="psql -X -q -t -A -v ON_ERROR_STOP=1 ${DB:+-d $DB}"
+
+if [ "$GENERATE" = 1 ]; then
+	echo "generating $ROWS changes on $KEYS keys (del_pct=$DEL_PCT skew=$SKEW width=$WIDTH)"
+	$PSQL -v rows="$ROWS" -v keys="$KEYS" -v del_pct="$DEL_PCT" \
+		-v skew="$SKEW" -v width="$WIDTH" -v batch="$BATCH" \
+		-f "$BENCH_DIR/generate.sql" >/dev/null
+fi
+
+$PSQL -c "SELECT 'log entries: ' || count(*) FROM bench_orig_log"
+
+# the most changed key, for the single key restores
+HOT_KEY=$($PSQL -c "SELECT id FROM bench_orig_log GROUP BY id ORDER BY count(*) DESC LIMIT 1")
+
+#
+# Runs a single restore in a new session, so the peak memory of
+# the backend belongs to this restore only.
+#
+#   $1 label, $2 target fraction, $3 method, $4 key or NULL,
+#   $5 condition counting the log entries in the replayed range
+#
+run_restore()
+{
+	$PSQL <<EOF
+SELECT trigger_changed AS target
+  FROM bench_orig_log
+ ORDER BY trigger_id
+OFFSET (SELECT (count(*) * $2)::bigint FROM bench_orig_log) LIMIT 1 \gset
+SELECT count(*) AS entries FROM bench_orig_log WHERE $5 \gset
+SELECT clock_timestamp() AS started \gset
+SELECT table_log_restore_table('bench_orig', 'id', 'bench_orig_log', 'trigger_id',
+                               'bench_restore', :'target', $4, $3) \g /dev/null
+SELECT extract(epoch FROM clock_timestamp() - :'started') AS seconds \gset
+SELECT rolsuper AS can_read FROM pg_roles WHERE rolname = current_user \gset
+\if :can_read
+SELECT coalesce((SELECT regexp_replace(line, '^VmHWM:\s*', '')
+                   FROM regexp_split_to_table(pg_read_file('/proc/self/status', 0, 65536, true), E'\n') line
+                  WHERE line LIKE 'VmHWM:%'), '-') AS peak \gset
+\else
+\set peak '-'
+\endif
+SELECT format('%-10s %5s %12s %10s %12s %12s', '$1', '$2', :entries,
+              round(:seconds::numeric, 3),
+              round(:entries / greatest(:seconds, 0.001)), :'peak');
+EOF
+}
+
+printf '%-10s %5s %12s %10s %12s %12s\n' restore target entries seconds "entries/s" "peak memory"
+
+for target in $TARGETS; do
+	run_restore forward  "$target" 0 "NULL" "trigger_changed <= :'target'"
+	run_restore backward "$target" 1 "NULL" "trigger_changed > :'target'"
+	run_restore hot-key  "$target" 1 "'$HOT_KEY'" "trigger_changed > :'target' AND id = $HOT_KEY"
+	run_restore one-key  "$target" 1 "'$KEYS'" "trigger_changed > :'target' AND id = $KEYS"
+done
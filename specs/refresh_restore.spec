@@ -0,0 +1,32 @@
+# A registered restore table must not miss log entries committed after
+# the restore with an id below its watermark: restoring waits for the
+# running change of s1, while s2 has already logged a later entry.
+
+setup
+{
+  CREATE TABLE test(id integer PRIMARY KEY, name text);
+  SELECT table_log_init(4, 'public', 'test', 'public', 'test_log');
+  INSERT INTO test VALUES (1, 'joe');
+}
+
+teardown
+{
+  DROP TABLE IF EXISTS test_recover;
+  DROP TABLE test;
+  DROP TABLE test_log;
+  DROP SEQUENCE test_log_seq;
+}
+
+session s1
+step s1b { BEGIN; }
+step s1u { UPDATE test SET name = 'barney' WHERE id = 1; }
+step s1c { COMMIT; }
+
+session s2
+step s2i { INSERT INTO test VALUES (2, 'monica'); }
+step s2r { SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                                          clock_timestamp(), NULL, 0, 3); }
+step s2f { SELECT table_log_refresh_restore('test_recover', clock_timestamp()); }
+step s2s { SELECT id, name FROM test_recover ORDER BY id; }
+
+permutation s1b s1u s2i s2r s1c s2f s2s
@@ -274,5 +274,740 @@ SELECT id, name FROM log.test_log_1;
 DROP SCHEMA log CASCADE;
 DROP TABLE test;
 
+--
+-- Check table_log_restore_table() with a composite primary key
+--
+CREATE TABLE test(id integer, sub integer, name text, PRIMARY KEY(id, sub));
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 1, 'joe');
+INSERT INTO test VALUES(1, 2, 'barney');
+INSERT INTO test VALUES(2, 1, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 2 AND sub = 1;
+UPDATE test SET sub = 3 WHERE id = 1 AND sub = 2;
+DELETE FROM test WHERE id = 1 AND sub = 1;
+
+-- passing NULL as the primary key column uses the whole primary key
+SELECT table_log_restore_table('test', NULL, 'test_log', 'trigger_id', 'test_recover', NOW());
+SELECT id, sub, name FROM test_recover ORDER BY id, sub;
+
+-- a single composite key is passed as a row literal
+SELECT table_log_restore_table('test', NULL, 'test_log', 'trigger_id', 'test_recover_key',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), '(2,1)');
+SELECT id, sub, name FROM test_recover_key ORDER BY id, sub;
+
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_key;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check set-based restore with parallel workers
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 3;
+UPDATE test SET id = 5 WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+
+SET table_log.restore_parallel_workers = 2;
+
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 5));
+SELECT id, name FROM test_recover ORDER BY id;
+
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_back',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 5), NULL, 1);
+SELECT id, name FROM test_recover_back ORDER BY id;
+
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_key',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 7), '5', 1);
+SELECT id, name FROM test_recover_key ORDER BY id;
+
+RESET table_log.restore_parallel_workers;
+
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_back;
+DROP TABLE test_recover_key;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check restore starting from a snapshot
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+SELECT table_log_snapshot('test', 'test_log');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 1;
+SELECT trigger_id, orig_rel, log_rel FROM table_log_snapshots;
+
+-- rolls forward from the snapshot
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4));
+SELECT id, name FROM test_recover ORDER BY id;
+
+-- rolls backward from the snapshot
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_back',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 1), NULL, 1);
+SELECT id, name FROM test_recover_back ORDER BY id;
+
+-- users who can't read the snapshot restore without it
+CREATE ROLE table_log_restore_user;
+GRANT SELECT ON test, test_log TO table_log_restore_user;
+SET ROLE table_log_restore_user;
+SELECT count(*) FROM table_log_snapshots;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_user',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4));
+SELECT id, name FROM test_recover_user ORDER BY id;
+RESET ROLE;
+GRANT SELECT ON test_log_snapshot_1 TO table_log_restore_user;
+SET ROLE table_log_restore_user;
+SELECT trigger_id, orig_rel, log_rel FROM table_log_snapshots;
+RESET ROLE;
+
+SELECT table_log_drop_snapshot('test_log_snapshot_1');
+SELECT count(*) FROM table_log_snapshots;
+
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_back;
+DROP TABLE test_recover_user;
+DROP SEQUENCE test_log_seq;
+DROP ROLE table_log_restore_user;
+
+--
+-- Check automatic choice of the restore method
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 1;
+ANALYZE test;
+ANALYZE test_log;
+SELECT start_from, method FROM table_log_explain_restore('test', NULL, 'test_log', 'trigger_id',
+                                                         (SELECT trigger_changed FROM test_log WHERE trigger_id = 4))
+ORDER BY method;
+SELECT count(*) FROM table_log_explain_restore('test', NULL, 'test_log', 'trigger_id',
+                                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4))
+WHERE chosen;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4), NULL, 2);
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check reading a table as of a timestamp
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 1;
+SELECT * FROM table_log_as_of('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 4))
+    AS t(id integer, name text) ORDER BY id;
+SELECT * FROM table_log_as_of('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 2), '2')
+    AS t(id integer, name text);
+-- must fail, the columns don't match the table
+SELECT * FROM table_log_as_of('test', 'test_log', now()) AS t(id integer);
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check the history of a single row
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 2;
+SELECT * FROM table_log_row_history('test', 'test_log', '2')
+    AS h(trigger_id bigint, trigger_mode varchar, trigger_tuple varchar, name text);
+SELECT * FROM table_log_row_history('test', 'test_log', '1')
+    AS h(trigger_id bigint, trigger_mode varchar, trigger_tuple varchar, name text);
+-- must fail, the column type doesn't match the log table
+SELECT * FROM table_log_row_history('test', 'test_log', '1') AS h(trigger_id integer);
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check the log table layout created by table_log_init()
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+SELECT indexname FROM pg_indexes WHERE tablename = 'test_log' ORDER BY indexname;
+SET enable_seqscan = off;
+-- all versions of a single key, in log order
+EXPLAIN (COSTS OFF) SELECT * FROM test_log WHERE id = 2 ORDER BY trigger_id;
+SET enable_indexscan = off;
+-- all log entries up to a timestamp
+EXPLAIN (COSTS OFF) SELECT * FROM test_log WHERE trigger_changed <= now();
+RESET enable_indexscan;
+RESET enable_seqscan;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+
+-- both partitions get the indexes
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', NULL, 'PARTITION');
+SELECT tablename, indexname FROM pg_indexes WHERE tablename IN ('test_log_0', 'test_log_1') ORDER BY indexname;
+DROP TABLE test;
+DROP VIEW  test_log;
+DROP TABLE test_log_0;
+DROP TABLE test_log_1;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check rewinding a table in place
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 3;
+INSERT INTO test VALUES(4, 'Jeanne D''Arc');
+CREATE TABLE test_target(id integer PRIMARY KEY, name text);
+INSERT INTO test_target SELECT * FROM test;
+-- rewind a copy first
+SELECT table_log_rewind('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), 'test_target');
+SELECT id, name FROM test_target ORDER BY id;
+SELECT id, name FROM test ORDER BY id;
+-- the rewind of the original table is logged as well
+SELECT table_log_rewind('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 3));
+SELECT id, name FROM test ORDER BY id;
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log WHERE trigger_id > 7 ORDER BY trigger_id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_target;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check refreshing a restore table
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 1;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 2), NULL, NULL::int, 3);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT restore_rel, orig_rel, log_rel, log_pkey, trigger_id FROM table_log_restores;
+-- forward
+SELECT table_log_refresh_restore('test_recover', (SELECT trigger_changed FROM test_log WHERE trigger_id = 5));
+SELECT id, name FROM test_recover ORDER BY id;
+-- backward
+SELECT table_log_refresh_restore('test_recover', (SELECT trigger_changed FROM test_log WHERE trigger_id = 1));
+SELECT id, name FROM test_recover ORDER BY id;
+-- must fail, the snapshot is older than the lock on test
+BEGIN ISOLATION LEVEL REPEATABLE READ;
+SELECT table_log_refresh_restore('test_recover', now());
+ROLLBACK;
+-- must fail, not a restore table
+SELECT table_log_refresh_restore('test', now());
+-- must fail, unlogged restore tables aren't registered
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_unlogged', now(), NULL, NULL::int, 2);
+SELECT table_log_refresh_restore('test_recover_unlogged', now());
+-- must fail, crash recovery may have emptied it
+ALTER TABLE test_recover SET UNLOGGED;
+SELECT table_log_refresh_restore('test_recover', now());
+ALTER TABLE test_recover SET LOGGED;
+-- users register and refresh their own restore tables only
+CREATE ROLE table_log_refresh_user;
+GRANT SELECT ON test, test_log TO table_log_refresh_user;
+GRANT CREATE ON SCHEMA public TO table_log_refresh_user;
+SET ROLE table_log_refresh_user;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_user',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 2), NULL, NULL::int, 3);
+SELECT restore_rel, trigger_id FROM table_log_restores;
+SELECT table_log_refresh_restore('test_recover_user', (SELECT trigger_changed FROM test_log WHERE trigger_id = 5));
+SELECT id, name FROM test_recover_user ORDER BY id;
+WITH d AS (DELETE FROM table_log_restores RETURNING 1) SELECT count(*) FROM d;
+RESET ROLE;
+SELECT restore_rel FROM table_log_restores ORDER BY restore_rel::text;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_unlogged;
+DROP TABLE test_recover_user;
+DROP SEQUENCE test_log_seq;
+REVOKE CREATE ON SCHEMA public FROM table_log_refresh_user;
+DROP ROLE table_log_refresh_user;
+
+--
+-- Check restoring many keys at once
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 3;
+UPDATE test SET name = 'joey' WHERE id = 1;
+-- from an array of keys
+SELECT table_log_restore_keys('test', 'test_log', 'test_recover',
+                              (SELECT trigger_changed FROM test_log WHERE trigger_id = 5), '{2,3}'::text[]);
+SELECT id, name FROM test_recover ORDER BY id;
+-- from a table of keys
+CREATE TABLE test_keys(id integer);
+INSERT INTO test_keys VALUES(1), (3);
+SELECT table_log_restore_keys('test', 'test_log', 'test_recover_2',
+                              (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), 'test_keys'::regclass);
+SELECT id, name FROM test_recover_2 ORDER BY id;
+-- must fail, the key table doesn't have the key columns
+CREATE TABLE test_badkeys(key integer);
+SELECT table_log_restore_keys('test', 'test_log', 'test_recover_3', now(), 'test_badkeys'::regclass);
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_keys;
+DROP TABLE test_badkeys;
+DROP TABLE test_recover;
+DROP TABLE test_recover_2;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check exporting and importing log ranges
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+-- a range of log entries
+SELECT table_log_export('test_log', 2, 4, 'table_log_regress_1.export');
+CREATE TABLE test_log_copy (LIKE test_log);
+SELECT table_log_import('test_log_copy', 'table_log_regress_1.export');
+SELECT id, name, trigger_mode, trigger_tuple, trigger_id FROM test_log_copy ORDER BY trigger_id;
+-- a range of time, with an open start
+SELECT table_log_export('test_log', NULL, (SELECT trigger_changed FROM test_log WHERE trigger_id = 1), 'table_log_regress_2.export');
+SELECT table_log_import('test_log_copy', 'table_log_regress_2.export');
+SELECT id, name, trigger_mode, trigger_tuple, trigger_id FROM test_log_copy ORDER BY trigger_id;
+-- must fail, the layout doesn't match
+CREATE TABLE test_other(id integer, name text);
+SELECT table_log_import('test_other', 'table_log_regress_1.export');
+-- must fail, outside of the data directory
+SELECT table_log_export('test_log', 1, 5, '/tmp/table_log_regress.export');
+SELECT table_log_export('test_log', 1, 5, '../table_log_regress.export');
+-- don't leave the files behind in the data directory
+COPY (SELECT) TO PROGRAM 'rm -f table_log_regress_1.export table_log_regress_2.export';
+SELECT count(*) FROM pg_ls_dir('.') AS f WHERE f LIKE 'table_log_regress%';
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_log_copy;
+DROP TABLE test_other;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check restoring several tables to the same point in time
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+CREATE TABLE test_line(id integer PRIMARY KEY, test_id integer, amount integer);
+SELECT table_log_init(5, 'test');
+SELECT table_log_init(5, 'test_line');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test_line VALUES(1, 1, 10);
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test_line VALUES(2, 2, 20);
+UPDATE test_line SET amount = 15 WHERE id = 1;
+DELETE FROM test_line WHERE id = 2;
+DELETE FROM test WHERE id = 2;
+SELECT * FROM table_log_restore_tables(ARRAY['test', 'test_line']::regclass[],
+                                       ARRAY['test_log', 'test_line_log']::regclass[],
+                                       ARRAY['test_recover', 'test_line_recover'],
+                                       (SELECT trigger_changed FROM test_line_log WHERE trigger_id = 2));
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT id, test_id, amount FROM test_line_recover ORDER BY id;
+-- must fail, no restore table for test_line
+SELECT * FROM table_log_restore_tables(ARRAY['test', 'test_line']::regclass[],
+                                       ARRAY['test_log', 'test_line_log']::regclass[],
+                                       ARRAY['test_recover_2'], now());
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_line;
+DROP TABLE test_line_log;
+DROP TABLE test_recover;
+DROP TABLE test_line_recover;
+DROP SEQUENCE test_log_seq;
+DROP SEQUENCE test_line_log_seq;
+
+--
+-- Check the progress view, empty without shared_preload_libraries
+--
+SELECT count(*) FROM table_log_stat_progress_restore;
+
+--
+-- Check the net changes between two timestamps
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+INSERT INTO test VALUES(3, 'monica');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 3;
+INSERT INTO test VALUES(4, 'Jeanne D''Arc');
+INSERT INTO test VALUES(5, 'fred');
+DELETE FROM test WHERE id = 5;
+UPDATE test SET name = 'joey' WHERE id = 1;
+UPDATE test SET name = 'joe' WHERE id = 1;
+-- keys 1 and 5 have no net change
+SELECT * FROM table_log_diff('test', 'test_log',
+                             (SELECT trigger_changed FROM test_log WHERE trigger_id = 3),
+                             (SELECT trigger_changed FROM test_log WHERE trigger_id = 13));
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check restoring the rows matching an expression
+--
+CREATE TABLE test(id integer PRIMARY KEY, tenant integer, name text);
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, 1, 'joe');
+INSERT INTO test VALUES(2, 2, 'barney');
+INSERT INTO test VALUES(3, 1, 'monica');
+UPDATE test SET tenant = 1 WHERE id = 2;
+UPDATE test SET tenant = 2 WHERE id = 3;
+DELETE FROM test WHERE id = 1;
+INSERT INTO test VALUES(4, 1, 'fred');
+SELECT table_log_restore_where('test', 'test_log', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), 'tenant = 1');
+SELECT id, tenant, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_where('test', 'test_log', 'test_recover_2', now(), 'tenant = 1');
+SELECT id, tenant, name FROM test_recover_2 ORDER BY id;
+-- must fail, not a single expression
+SELECT table_log_restore_where('test', 'test_log', 'test_recover_3', now(), 'true) UNION (SELECT 1');
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_2;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check logging TRUNCATE as a single marker
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', false,
+                      '{INSERT, UPDATE, DELETE, TRUNCATE}');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+TRUNCATE test;
+INSERT INTO test VALUES(3, 'monica');
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+-- rolls forward from the snapshot taken by the TRUNCATE over the marker
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', now());
+SELECT id, name FROM test_recover ORDER BY id;
+SET table_log.restore_parallel_workers = 2;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_2', now());
+SELECT id, name FROM test_recover_2 ORDER BY id;
+RESET table_log.restore_parallel_workers;
+-- rolls backward from the snapshot, never over the marker
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_back',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 2), NULL, 1);
+SELECT id, name FROM test_recover_back ORDER BY id;
+SELECT * FROM table_log_as_of('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 2))
+    AS t(id integer, name text) ORDER BY id;
+-- must fail, the truncated rows are only in the snapshot
+SELECT * FROM table_log_diff('test', 'test_log',
+                             (SELECT trigger_changed FROM test_log WHERE trigger_id = 1), now());
+SELECT table_log_drop_snapshot(snapshot_rel) FROM table_log_snapshots WHERE orig_rel = 'test'::regclass;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_2;
+DROP TABLE test_recover_back;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check coalescing the changes of a transaction
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', false,
+                      '{INSERT, UPDATE, DELETE}', true);
+INSERT INTO test VALUES(1, 'joe');
+BEGIN;
+UPDATE test SET name = 'joey' WHERE id = 1;
+UPDATE test SET name = 'joseph' WHERE id = 1;
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'monica');
+DELETE FROM test WHERE id = 3;
+COMMIT;
+BEGIN;
+UPDATE test SET id = 4 WHERE id = 1;
+DELETE FROM test WHERE id = 4;
+COMMIT;
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4));
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check restoring from a log written in basic mode
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', true);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+UPDATE test SET name = 'monica' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), NULL, 1);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_2',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), NULL, 2);
+SELECT id, name FROM test_recover_2 ORDER BY id;
+-- must fail, rolling forward needs the new values of updates
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_3',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), NULL, 0);
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_2;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check logging in chain mode
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text NOT NULL);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', false,
+                      '{INSERT, UPDATE, DELETE}', false, true);
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+UPDATE test SET id = 3 WHERE id = 1;
+DELETE FROM test WHERE id = 2;
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), NULL, 0);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_back',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 3), NULL, 1);
+SELECT id, name FROM test_recover_back ORDER BY id;
+SELECT * FROM table_log_as_of('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 3))
+    AS t(id integer, name text) ORDER BY id;
+-- must fail, there are no old images to compare
+SELECT * FROM table_log_diff('test', 'test_log',
+                             (SELECT trigger_changed FROM test_log WHERE trigger_id = 1), now());
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_back;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check the index and the unlogged restore table
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', now(), NULL, 0, 2);
+SELECT relpersistence FROM pg_class WHERE relname = 'test_recover';
+SELECT indexname FROM pg_indexes WHERE tablename = 'test_recover';
+SELECT id, name FROM test_recover ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check compacting the log into a baseline
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+DELETE FROM test WHERE id = 1;
+UPDATE test SET name = 'monica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'fred');
+SELECT table_log_compact('test', 'test_log', (SELECT trigger_changed FROM test_log WHERE trigger_id = 5));
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 4), NULL, 0);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover_now', now(), NULL, 0);
+SELECT id, name FROM test_recover_now ORDER BY id;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP TABLE test_recover_now;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check verifying the log against the table
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+SELECT * FROM table_log_verify('test', 'test_log');
+ALTER TABLE test DISABLE TRIGGER USER;
+DELETE FROM test WHERE id = 1;
+UPDATE test SET name = 'monica' WHERE id = 2;
+INSERT INTO test VALUES(3, 'fred');
+ALTER TABLE test ENABLE TRIGGER USER;
+SELECT * FROM table_log_verify('test', 'test_log');
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check logging into the shared journal
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+CREATE TABLE test2(id integer PRIMARY KEY, amount integer);
+SELECT table_log_init(4, 'public', 'test', 'public', 'test_log', 'JOURNAL');
+SELECT table_log_init(4, 'public', 'test2', 'public', 'test2_log', 'JOURNAL');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test2 VALUES(1, 10);
+UPDATE test SET name = 'barney' WHERE id = 1;
+DELETE FROM test2 WHERE id = 1;
+SELECT trigger_relid, trigger_mode, trigger_tuple, trigger_row FROM table_log_journal ORDER BY trigger_id;
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT min(trigger_changed) FROM test_log), NULL, 0);
+SELECT id, name FROM test_recover ORDER BY id;
+-- the entries written before stay readable
+ALTER TABLE test ADD COLUMN note text;
+INSERT INTO test VALUES(2, 'monica', 'new');
+SELECT id, name, trigger_mode, trigger_tuple FROM test_log ORDER BY trigger_id;
+-- users write to the journal only through the triggers
+CREATE ROLE table_log_journal_user;
+GRANT SELECT, INSERT ON test TO table_log_journal_user;
+SELECT has_table_privilege('table_log_journal_user', 'table_log_journal', 'INSERT');
+SET ROLE table_log_journal_user;
+INSERT INTO test VALUES(3, 'veronica', NULL);
+SELECT trigger_relid, trigger_mode, trigger_row FROM table_log_journal ORDER BY trigger_id;
+RESET ROLE;
+-- casts to json run as the user changing the row, not as the journal owner
+CREATE TYPE test_mood AS ENUM ('ok');
+CREATE FUNCTION test_mood_json(test_mood) RETURNS json AS 'SELECT to_json(current_user::text)' LANGUAGE sql;
+CREATE CAST (test_mood AS json) WITH FUNCTION test_mood_json(test_mood);
+ALTER TABLE test ADD COLUMN mood test_mood;
+SET ROLE table_log_journal_user;
+INSERT INTO test VALUES(4, 'phoebe', NULL, 'ok');
+SELECT trigger_row FROM table_log_journal WHERE trigger_row->>'id' = '4';
+RESET ROLE;
+DROP VIEW test_log;
+DROP VIEW test2_log;
+DROP TABLE test;
+DROP TABLE test2;
+DROP TABLE test_recover;
+DROP CAST (test_mood AS json);
+DROP FUNCTION test_mood_json(test_mood);
+DROP TYPE test_mood;
+DROP ROLE table_log_journal_user;
+DELETE FROM table_log_journal;
+
+--
+-- Check an empty string in a composite primary key
+--
+CREATE TABLE test(id integer, tag text, name text, PRIMARY KEY(id, tag));
+SELECT table_log_init(5, 'test');
+INSERT INTO test VALUES(1, '', 'joe');
+INSERT INTO test VALUES(1, 'x', 'barney');
+SELECT table_log_restore_table('test', NULL, 'test_log', 'trigger_id', 'test_recover', now(), '(1,"")');
+SELECT id, tag, name FROM test_recover ORDER BY id, tag;
+-- must fail, an empty field is NULL
+SELECT table_log_restore_table('test', NULL, 'test_log', 'trigger_id', 'test_recover_null', now(), '(1,)');
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check rolling a basic log backward over a TRUNCATE
+--
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', true,
+                      '{INSERT, UPDATE, DELETE, TRUNCATE}');
+INSERT INTO test VALUES(1, 'joe');
+INSERT INTO test VALUES(2, 'barney');
+UPDATE test SET name = 'veronica' WHERE id = 2;
+TRUNCATE test;
+INSERT INTO test VALUES(3, 'monica');
+SELECT trigger_id, trigger_mode, trigger_tuple, id, name FROM test_log ORDER BY trigger_id;
+SELECT count(*) FROM table_log_snapshots WHERE orig_rel = 'test'::regclass;
+-- rolls backward from the snapshot taken by the TRUNCATE
+SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover',
+                               (SELECT trigger_changed FROM test_log WHERE trigger_id = 2), NULL, 1);
+SELECT id, name FROM test_recover ORDER BY id;
+SELECT table_log_drop_snapshot(snapshot_rel) FROM table_log_snapshots WHERE orig_rel = 'test'::regclass;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP TABLE test_recover;
+DROP SEQUENCE test_log_seq;
+
+--
+-- Check TRUNCATE by a user who doesn't own the table
+--
+CREATE ROLE table_log_owner;
+CREATE ROLE table_log_truncate_user;
+GRANT CREATE ON SCHEMA public TO table_log_owner;
+SET ROLE table_log_owner;
+CREATE TABLE test(id integer PRIMARY KEY, name text);
+SELECT table_log_init(5, 'public', 'test', 'public', 'test_log', 'SINGLE', false,
+                      '{INSERT, UPDATE, DELETE, TRUNCATE}');
+INSERT INTO test VALUES(1, 'joe');
+GRANT TRUNCATE ON test TO table_log_truncate_user;
+GRANT INSERT ON test_log TO table_log_truncate_user;
+GRANT USAGE ON SEQUENCE test_log_seq TO table_log_truncate_user;
+SET ROLE table_log_truncate_user;
+TRUNCATE test;
+-- must fail, only the owner of a table registers its snapshots
+INSERT INTO table_log_snapshots VALUES (0, 'test', 'test', 'test_log', 0, now());
+RESET ROLE;
+-- the snapshot is taken and registered as the owner
+SELECT pg_get_userbyid(c.relowner) AS snapshot_owner, s.trigger_id
+  FROM table_log_snapshots s JOIN pg_class c ON c.oid = s.snapshot_rel
+ WHERE s.orig_rel = 'test'::regclass;
+SELECT table_log_drop_snapshot(snapshot_rel) FROM table_log_snapshots WHERE orig_rel = 'test'::regclass;
+DROP TABLE test;
+DROP TABLE test_log;
+DROP SEQUENCE test_log_seq;
+REVOKE CREATE ON SCHEMA public FROM table_log_owner;
+DROP ROLE table_log_truncate_user;
+DROP ROLE table_log_owner;
+
 RESET client_min_messages;
 
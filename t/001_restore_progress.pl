@@ -0,0 +1,112 @@
+#
+# Progress of a running restore, as seen from another session
+#
+# The progress slots live in shared memory, so this needs a server
+# with table_log in shared_preload_libraries.
+#
+use strict;
+use warnings;
+use IPC::Run;
+use Test::More;
+
+# PostgresNode was renamed to PostgreSQL::Test::Cluster in 15
+my $node;
+if (eval { require PostgreSQL::Test::Cluster; 1 })
+{
+	$node = PostgreSQL::Test::Cluster->new('main');
+}
+else
+{
+	require PostgresNode;
+	$node = PostgresNode->get_new_node('main');
+}
+
+$node->init;
+$node->append_conf('postgresql.conf', "shared_preload_libraries = 'table_log'");
+$node->start;
+
+# The restore blocks on log entry 1500, until the advisory lock held
+# by another session is released. The check only runs for values
+# written into a slow_id column, the restore table inherits the
+# domain from the original table.
+$node->safe_psql('postgres', q{
+CREATE EXTENSION table_log;
+CREATE FUNCTION table_log_wait() RETURNS boolean AS $$
+BEGIN
+    PERFORM pg_advisory_xact_lock_shared(4711);
+    RETURN true;
+END
+$$ LANGUAGE plpgsql;
+CREATE DOMAIN slow_id AS INT CHECK (VALUE <> 1500 OR table_log_wait());
+CREATE TABLE test (id slow_id PRIMARY KEY, name TEXT);
+SELECT table_log_init(4, 'test');
+INSERT INTO test SELECT g, 'name ' || g FROM generate_series(1, 2000) g;
+CREATE ROLE table_log_other;
+CREATE ROLE table_log_stats IN ROLE pg_read_all_stats;
+});
+
+my $timeout = IPC::Run::timeout(180);
+
+my ($holder_in, $holder_out) = ('', '');
+my $holder = IPC::Run::start(
+	[ 'psql', '-X', '-q', '-d', $node->connstr('postgres') ],
+	'<', \$holder_in, '>', \$holder_out, '2>', \$holder_out, $timeout);
+$holder_in .= "BEGIN;\nSELECT pg_advisory_xact_lock(4711);\n\\echo locked\n";
+$holder->pump until $holder_out =~ /locked/;
+
+my ($restore_out, $restore_err) = ('', '');
+my $restore = IPC::Run::start(
+	[
+		'psql', '-X', '-q', '-A', '-t', '-v', 'ON_ERROR_STOP=1',
+		'-d', $node->connstr('postgres'), '-c',
+		"SELECT table_log_restore_table('test', 'id', 'test_log', 'trigger_id', 'test_recover', NOW())"
+	],
+	'>', \$restore_out, '2>', \$restore_err, $timeout);
+
+ok( $node->poll_query_until(
+		'postgres', q{
+SELECT count(*) = 1 FROM pg_locks
+ WHERE locktype = 'advisory' AND NOT granted AND mode = 'ShareLock'
+}),
+	'restore waits on log entry 1500');
+
+# entries are applied in the order they were logged, the counter is
+# last updated after 1000 of the 1499 entries before the blocking one
+is( $node->safe_psql(
+		'postgres', q{
+SELECT datname, relid, phase, log_rows_total, log_rows_applied
+  FROM table_log_stat_progress_restore
+}),
+	'postgres|test|replaying|2000|1000',
+	'progress of the restore in the replaying phase');
+
+is( $node->safe_psql(
+		'postgres', q{
+SET ROLE table_log_other;
+SELECT count(*) FROM table_log_stat_progress_restore;
+}),
+	'0',
+	'restores of other roles are hidden');
+
+is( $node->safe_psql(
+		'postgres', q{
+SET ROLE table_log_stats;
+SELECT count(*) FROM table_log_stat_progress_restore;
+}),
+	'1',
+	'members of pg_read_all_stats see all restores');
+
+$holder_in .= "COMMIT;\n\\q\n";
+$holder->finish;
+
+ok($restore->finish, 'restore finished without errors') or diag($restore_err);
+like($restore_out, qr/test_recover/, 'restore returns the restore table');
+
+is( $node->safe_psql(
+		'postgres', 'SELECT count(*) FROM table_log_stat_progress_restore'),
+	'0',
+	'progress slot is released after the restore');
+
+$node->stop;
+
+done_testing();
@@ -0,0 +1,591 @@
+--
+-- table_log () -- log changes to another table
+--
+--
+-- see README.md for details
+--
+--
+-- written by Andreas ' ads' Scherbaum (ads@pgug.de)
+--
+--
+
+-- create function
+
+CREATE FUNCTION table_log_basic()
+    RETURNS TRIGGER
+    AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION table_log_chain()
+    RETURNS TRIGGER
+    AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION table_log ()
+    RETURNS TRIGGER
+    AS 'MODULE_PATHNAME' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR, INT, INT)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR, INT)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+CREATE FUNCTION "table_log_restore_table" (VARCHAR, VARCHAR, CHAR, CHAR, CHAR, TIMESTAMPTZ)
+    RETURNS VARCHAR
+    AS 'MODULE_PATHNAME', 'table_log_restore_table' LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text, text, text, text DEFAULT 'SINGLE',
+                                          boolean DEFAULT false,
+                                          text[] DEFAULT '{INSERT, UPDATE, DELETE}'::text[],
+                                          boolean DEFAULT false,
+                                          boolean DEFAULT false) RETURNS void AS
+$table_log_init$
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    orig_name    ALIAS FOR $3;
+    log_schema   ALIAS FOR $4;
+    log_name     ALIAS FOR $5;
+    partition_mode ALIAS FOR $6;
+    basic_mode     ALIAS FOR $7;
+    log_actions  ALIAS FOR $8;
+    coalesce_mode ALIAS FOR $9;
+    chain_mode   ALIAS FOR $10;
+    do_log_user  int = 0;
+    level_create text = '';
+    orig_qq      text;
+    log_qq       text;
+    log_part     text[];
+    log_seq      text;
+    num_log_tables integer;
+    trigger_func text := 'table_log';
+    trigger_actions text := '';
+    row_actions  text[];
+    log_truncate boolean;
+    log_tables   text[];
+    log_table    text;
+    orig_pk      text;
+    col_name     name;
+    i integer;
+BEGIN
+    -- Handle if someone doesn't want an explicit log table name
+    log_name := COALESCE(log_name, orig_name || '_log');
+
+    -- Quoted qualified names
+    orig_qq := quote_ident(orig_schema) || '.' || quote_ident(orig_name);
+    log_qq := quote_ident(log_schema) || '.'  || quote_ident(log_name);
+    log_seq := quote_ident(log_schema) || '.' || quote_ident(log_name || '_seq');
+    log_part[0] := quote_ident(log_schema) || '.' || quote_ident(log_name || '_0');
+    log_part[1] := quote_ident(log_schema) || '.' || quote_ident(log_name || '_1');
+
+    -- Valid trigger actions?
+    IF (COALESCE(array_length(log_actions, 1), 0) = 0) THEN
+       RAISE EXCEPTION 'table_log_init: at least one trigger action must be specified';
+    END IF;
+
+    -- TRUNCATE is logged by a statement trigger of its own
+    log_truncate := 'TRUNCATE' = ANY (log_actions);
+    row_actions := array_remove(log_actions, 'TRUNCATE');
+
+    IF basic_mode AND chain_mode THEN
+        RAISE EXCEPTION 'table_log_init: basic_mode and chain_mode exclude each other';
+    END IF;
+
+    -- Valid partition mode ?
+    IF (partition_mode NOT IN ('SINGLE', 'PARTITION', 'JOURNAL')) THEN
+        RAISE EXCEPTION 'table_log_init: unsupported partition mode %', partition_mode;
+    END IF;
+
+    IF level <> 3 THEN
+
+       --
+       -- Create a sequence used by trigger_id, if requested. The
+       -- journal has a sequence of its own.
+       --
+       IF (partition_mode <> 'JOURNAL') THEN
+           EXECUTE 'CREATE SEQUENCE ' || log_seq;
+       END IF;
+
+       level_create := level_create
+           || ', trigger_id BIGINT'
+           || ' DEFAULT nextval($$' || log_seq || '$$::regclass)'
+           || ' NOT NULL PRIMARY KEY';
+
+       IF level <> 4 THEN
+           level_create := level_create
+               || ', trigger_user VARCHAR(32) NOT NULL';
+           do_log_user := 1;
+           IF level <> 5 THEN
+               RAISE EXCEPTION
+                   'table_log_init: First arg has to be 3, 4 or 5.';
+           END IF;
+       END IF;
+    END IF;
+
+    IF (partition_mode = 'SINGLE') THEN
+        EXECUTE  'CREATE TABLE ' || log_qq
+              || '(LIKE ' || orig_qq
+              || ', trigger_mode VARCHAR(10) NOT NULL'
+              || ', trigger_tuple VARCHAR(5) NOT NULL'
+              || ', trigger_changed TIMESTAMPTZ NOT NULL'
+              || level_create
+              || ')';
+
+    ELSIF (partition_mode = 'PARTITION') THEN
+        -- Partitioned mode requested...
+        EXECUTE  'CREATE TABLE ' || log_part[0]
+              || '(LIKE ' || orig_qq
+              || ', trigger_mode VARCHAR(10) NOT NULL'
+              || ', trigger_tuple VARCHAR(5) NOT NULL'
+              || ', trigger_changed TIMESTAMPTZ NOT NULL'
+              || level_create
+              || ')';
+
+        EXECUTE  'CREATE TABLE ' || log_part[1]
+              || '(LIKE ' || orig_qq
+              || ', trigger_mode VARCHAR(10) NOT NULL'
+              || ', trigger_tuple VARCHAR(5) NOT NULL'
+              || ', trigger_changed TIMESTAMPTZ NOT NULL'
+              || level_create
+              || ')';
+
+        EXECUTE 'CREATE VIEW ' || log_qq
+              || ' AS SELECT * FROM ' || log_part[0] || ' UNION ALL '
+              || 'SELECT * FROM ' || log_part[1] || '';
+
+    ELSE
+        -- Journal mode: the log table is a view over the entries of
+        -- the original table in the shared journal. The rows are kept
+        -- as jsonb by column name, so entries written before an ALTER
+        -- TABLE of the original table still map to its columns.
+        EXECUTE  'CREATE VIEW ' || log_qq
+              || ' AS SELECT r.*, j.trigger_mode, j.trigger_tuple, j.trigger_changed'
+              || CASE WHEN level <> 3 THEN ', j.trigger_id' ELSE '' END
+              || CASE WHEN do_log_user = 1 THEN ', j.trigger_user' ELSE '' END
+              || ' FROM @extschema@.table_log_journal j'
+              || ' CROSS JOIN LATERAL jsonb_populate_record(NULL::' || orig_qq
+              || ', j.trigger_row) r'
+              || ' WHERE j.trigger_relid = ' || quote_literal(orig_qq) || '::regclass';
+    END IF;
+
+    --
+    -- Tune the log table(s) for appending rows and for the
+    -- queries of the restore functions: a BRIN index on trigger_changed
+    -- for the time range and a btree on the original primary key and
+    -- trigger_id for single rows in log order.
+    --
+    IF (partition_mode = 'SINGLE') THEN
+        log_tables := ARRAY[log_qq];
+    ELSIF (partition_mode = 'PARTITION') THEN
+        log_tables := ARRAY[log_part[0], log_part[1]];
+    ELSE
+        -- the journal is set up by the extension
+        log_tables := ARRAY[]::text[];
+    END IF;
+
+    SELECT string_agg(quote_ident(a.attname), ', ' ORDER BY k.ord) INTO orig_pk
+      FROM pg_catalog.pg_index x
+           CROSS JOIN LATERAL unnest(x.indkey::int2[]) WITH ORDINALITY AS k(attnum, ord)
+           JOIN pg_catalog.pg_attribute a ON a.attrelid = x.indrelid AND a.attnum = k.attnum
+     WHERE x.indrelid = orig_qq::regclass
+       AND x.indisprimary;
+
+    -- the log entries of a key are chained by the key
+    IF chain_mode AND (level = 3 OR orig_pk IS NULL) THEN
+        RAISE EXCEPTION 'table_log_init: chain_mode needs a primary key on % and trigger_id', orig_qq;
+    END IF;
+
+    FOREACH log_table IN ARRAY log_tables
+    LOOP
+        EXECUTE 'ALTER TABLE ' || log_table
+              || ' SET (fillfactor = 100, autovacuum_analyze_scale_factor = 0.02)';
+
+        -- insert driven autovacuum keeps the visibility map current
+        IF current_setting('server_version_num')::integer >= 130000 THEN
+            EXECUTE 'ALTER TABLE ' || log_table
+                  || ' SET (autovacuum_vacuum_insert_scale_factor = 0.05)';
+        END IF;
+
+        EXECUTE 'CREATE INDEX ON ' || log_table || ' USING brin (trigger_changed)';
+
+        IF level <> 3 AND orig_pk IS NOT NULL THEN
+            EXECUTE 'CREATE INDEX ON ' || log_table || ' (' || orig_pk || ', trigger_id)';
+        END IF;
+
+        -- the TRUNCATE marker has all columns of the original table NULL,
+        -- the tombstones of chain mode all but the key
+        IF log_truncate OR chain_mode THEN
+            FOR col_name IN SELECT a.attname
+                              FROM pg_catalog.pg_attribute a
+                             WHERE a.attrelid = orig_qq::regclass
+                               AND a.attnum > 0
+                               AND NOT a.attisdropped
+                               AND a.attnotnull
+            LOOP
+                EXECUTE 'ALTER TABLE ' || log_table
+                      || ' ALTER COLUMN ' || quote_ident(col_name) || ' DROP NOT NULL';
+            END LOOP;
+        END IF;
+    END LOOP;
+
+    --
+    -- Either use basic, chain or full trigger mode
+    --
+    IF basic_mode THEN
+       trigger_func := 'table_log_basic';
+    ELSIF chain_mode THEN
+       trigger_func := 'table_log_chain';
+    END IF;
+
+    --
+    -- Build action string for trigger DDL
+    --
+    FOR i IN 1..COALESCE(array_length(row_actions, 1), 0)
+    LOOP
+
+        trigger_actions := trigger_actions || row_actions[i];
+
+        IF i < array_length(row_actions, 1) THEN
+           trigger_actions := trigger_actions || ' OR ';
+        END IF;
+
+    END LOOP;
+
+    --
+    -- A deferred constraint trigger fires at commit and logs
+    -- only the net change of each row by the transaction
+    --
+    IF trigger_actions <> '' AND coalesce_mode THEN
+        EXECUTE 'CREATE CONSTRAINT TRIGGER "table_log_trigger" AFTER ' || trigger_actions || ' ON '
+                || orig_qq || ' DEFERRABLE INITIALLY DEFERRED'
+                || ' FOR EACH ROW EXECUTE PROCEDURE ' || trigger_func || '('
+                || quote_literal(log_name) || ','
+                || do_log_user || ','
+                || quote_literal(log_schema) || ','
+                || quote_literal(partition_mode)
+                || ')';
+    ELSIF trigger_actions <> '' THEN
+        EXECUTE 'CREATE TRIGGER "table_log_trigger" AFTER ' || trigger_actions || ' ON '
+                || orig_qq || ' FOR EACH ROW EXECUTE PROCEDURE ' || trigger_func || '('
+                || quote_literal(log_name) || ','
+                || do_log_user || ','
+                || quote_literal(log_schema) || ','
+                || quote_literal(partition_mode)
+                || ')';
+    END IF;
+
+    -- before the TRUNCATE, so a snapshot can keep the rows
+    IF log_truncate THEN
+        EXECUTE 'CREATE TRIGGER "table_log_truncate_trigger" BEFORE TRUNCATE ON '
+                || orig_qq || ' FOR EACH STATEMENT EXECUTE PROCEDURE ' || trigger_func || '('
+                || quote_literal(log_name) || ','
+                || do_log_user || ','
+                || quote_literal(log_schema) || ','
+                || quote_literal(partition_mode)
+                || ')';
+    END IF;
+
+    RETURN;
+END;
+$table_log_init$
+LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_name    ALIAS FOR $2;
+BEGIN
+    PERFORM table_log_init(level, orig_name, current_schema());
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_name    ALIAS FOR $2;
+    log_schema   ALIAS FOR $3;
+BEGIN
+    PERFORM table_log_init(level, current_schema(), orig_name, log_schema);
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+
+CREATE OR REPLACE FUNCTION table_log_init(int, text, text, text) RETURNS void AS '
+DECLARE
+    level        ALIAS FOR $1;
+    orig_schema  ALIAS FOR $2;
+    orig_name    ALIAS FOR $3;
+    log_schema   ALIAS FOR $4;
+BEGIN
+    PERFORM table_log_init(level, orig_schema, orig_name, log_schema,
+        CASE WHEN orig_schema=log_schema
+            THEN orig_name||''_log'' ELSE orig_name END);
+    RETURN;
+END;
+' LANGUAGE plpgsql;
+
+--
+-- Snapshots of logged tables, used as starting points by
+-- table_log_restore_table()
+--
+CREATE TABLE table_log_snapshots (
+    snapshot_id      SERIAL      NOT NULL PRIMARY KEY,
+    snapshot_rel     REGCLASS    NOT NULL,
+    orig_rel         REGCLASS    NOT NULL,
+    log_rel          REGCLASS    NOT NULL,
+    trigger_id       BIGINT      NOT NULL,
+    trigger_changed  TIMESTAMPTZ NOT NULL
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_snapshots', '');
+SELECT pg_catalog.pg_extension_config_dump('table_log_snapshots_snapshot_id_seq', '');
+
+-- Restores by any user look for snapshots, each user only sees
+-- the snapshots they can read
+GRANT SELECT ON table_log_snapshots TO PUBLIC;
+ALTER TABLE table_log_snapshots ENABLE ROW LEVEL SECURITY;
+CREATE POLICY table_log_snapshots_select ON table_log_snapshots FOR SELECT
+    USING (pg_catalog.has_table_privilege(snapshot_rel, 'SELECT'));
+
+-- Owners of a table register and drop its snapshots, snapshots
+-- taken by a TRUNCATE are registered as the owner of the table
+GRANT INSERT, DELETE ON table_log_snapshots TO PUBLIC;
+GRANT USAGE ON SEQUENCE table_log_snapshots_snapshot_id_seq TO PUBLIC;
+CREATE POLICY table_log_snapshots_insert ON table_log_snapshots FOR INSERT
+    WITH CHECK (pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = snapshot_rel), 'USAGE')
+                AND pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = orig_rel), 'USAGE'));
+CREATE POLICY table_log_snapshots_delete ON table_log_snapshots FOR DELETE
+    USING (pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = snapshot_rel), 'USAGE'));
+
+CREATE OR REPLACE FUNCTION table_log_snapshot(regclass, regclass, text DEFAULT NULL) RETURNS regclass AS
+$table_log_snapshot$
+DECLARE
+    orig_table    ALIAS FOR $1;
+    log_table     ALIAS FOR $2;
+    snapshot_name ALIAS FOR $3;
+    snap_id       integer;
+    snap_qq       text;
+    log_schema    name;
+    log_name      name;
+    watermark     bigint;
+BEGIN
+    -- Block concurrent changes, so the snapshot matches the log exactly
+    EXECUTE 'LOCK TABLE ' || orig_table::text || ' IN SHARE MODE';
+
+    SELECT n.nspname, c.relname INTO log_schema, log_name
+      FROM pg_catalog.pg_class c
+      JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace
+     WHERE c.oid = log_table;
+
+    snap_id := nextval(pg_catalog.pg_get_serial_sequence('@extschema@.table_log_snapshots', 'snapshot_id'));
+    snap_qq := quote_ident(log_schema) || '.'
+            || quote_ident(COALESCE(snapshot_name, log_name || '_snapshot_' || snap_id));
+
+    EXECUTE 'SELECT COALESCE(max(trigger_id), 0) FROM ' || log_table::text INTO watermark;
+    EXECUTE 'CREATE TABLE ' || snap_qq || ' AS SELECT * FROM ' || orig_table::text;
+
+    INSERT INTO @extschema@.table_log_snapshots
+        VALUES (snap_id, snap_qq::regclass, orig_table, log_table, watermark, clock_timestamp());
+
+    RETURN snap_qq::regclass;
+END;
+$table_log_snapshot$
+LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION table_log_drop_snapshot(regclass) RETURNS void AS
+$table_log_drop_snapshot$
+DECLARE
+    snapshot_table ALIAS FOR $1;
+BEGIN
+    DELETE FROM @extschema@.table_log_snapshots s WHERE s.snapshot_rel = snapshot_table;
+    EXECUTE 'DROP TABLE ' || snapshot_table::text;
+    RETURN;
+END;
+$table_log_drop_snapshot$
+LANGUAGE plpgsql;
+
+--
+-- Estimated cost of the possible starting points of a restore,
+-- see restore method 2 of table_log_restore_table()
+--
+CREATE FUNCTION table_log_explain_restore(VARCHAR, VARCHAR, CHAR, CHAR, TIMESTAMPTZ, CHAR DEFAULT NULL,
+                                          OUT start_from TEXT, OUT method INT,
+                                          OUT base_rows FLOAT8, OUT log_rows FLOAT8,
+                                          OUT cost FLOAT8, OUT chosen BOOLEAN)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_explain_restore' LANGUAGE C;
+
+--
+-- Rows of a logged table at a timestamp, without creating
+-- a restore table
+--
+CREATE FUNCTION table_log_as_of(REGCLASS, REGCLASS, TIMESTAMPTZ, TEXT DEFAULT NULL, TEXT DEFAULT 'trigger_id')
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_as_of' LANGUAGE C;
+
+--
+-- All logged versions of a single row
+--
+CREATE FUNCTION table_log_row_history(REGCLASS, REGCLASS, TEXT, TEXT DEFAULT 'trigger_id')
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_row_history' LANGUAGE C;
+
+--
+-- Rewind a table in place
+--
+CREATE FUNCTION table_log_rewind(REGCLASS, REGCLASS, TIMESTAMPTZ, REGCLASS DEFAULT NULL, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_rewind' LANGUAGE C;
+
+--
+-- Restore tables created by table_log_restore_table(), see
+-- table_log_refresh_restore()
+--
+CREATE TABLE table_log_restores (
+    restore_rel      REGCLASS    NOT NULL PRIMARY KEY,
+    orig_rel         REGCLASS    NOT NULL,
+    log_rel          REGCLASS    NOT NULL,
+    log_pkey         TEXT        NOT NULL,
+    restored_to      TIMESTAMPTZ NOT NULL,
+    trigger_id       BIGINT      NOT NULL
+);
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_restores', '');
+
+-- Users register and refresh their own restore tables, the owner
+-- of the log table may remove the entries of its restore tables
+-- (see table_log_compact()) and anyone those of dropped tables
+GRANT SELECT, INSERT, UPDATE, DELETE ON table_log_restores TO PUBLIC;
+ALTER TABLE table_log_restores ENABLE ROW LEVEL SECURITY;
+CREATE POLICY table_log_restores_owner ON table_log_restores
+    USING (NOT EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = restore_rel)
+           OR pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = restore_rel), 'USAGE')
+           OR pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = log_rel), 'USAGE'))
+    WITH CHECK (pg_catalog.pg_has_role((SELECT c.relowner FROM pg_catalog.pg_class c WHERE c.oid = restore_rel), 'USAGE'));
+
+CREATE FUNCTION table_log_refresh_restore(REGCLASS, TIMESTAMPTZ)
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_refresh_restore' LANGUAGE C;
+
+--
+-- Restore many keys at once, from an array of keys or
+-- from a table of keys
+--
+CREATE FUNCTION table_log_restore_keys(REGCLASS, REGCLASS, TEXT, TIMESTAMPTZ, TEXT[], INT DEFAULT 0, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_restore_keys' LANGUAGE C;
+
+CREATE FUNCTION table_log_restore_keys(REGCLASS, REGCLASS, TEXT, TIMESTAMPTZ, REGCLASS, INT DEFAULT 0, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_restore_keys' LANGUAGE C;
+
+--
+-- Export a range of a log table into a file below the data
+-- directory and load it back
+--
+CREATE FUNCTION table_log_export(REGCLASS, BIGINT, BIGINT, TEXT, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_export' LANGUAGE C;
+
+CREATE FUNCTION table_log_export(REGCLASS, TIMESTAMPTZ, TIMESTAMPTZ, TEXT, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_export' LANGUAGE C;
+
+CREATE FUNCTION table_log_import(REGCLASS, TEXT)
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_import' LANGUAGE C;
+
+REVOKE ALL ON FUNCTION table_log_export(REGCLASS, BIGINT, BIGINT, TEXT, TEXT) FROM PUBLIC;
+REVOKE ALL ON FUNCTION table_log_export(REGCLASS, TIMESTAMPTZ, TIMESTAMPTZ, TEXT, TEXT) FROM PUBLIC;
+REVOKE ALL ON FUNCTION table_log_import(REGCLASS, TEXT) FROM PUBLIC;
+
+--
+-- Restore several tables to the same point in time
+--
+CREATE FUNCTION table_log_restore_tables(REGCLASS[], REGCLASS[], TEXT[], TIMESTAMPTZ, INT DEFAULT 0, TEXT DEFAULT 'trigger_id',
+                                         OUT restore_table TEXT, OUT restored BIGINT)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_restore_tables' LANGUAGE C;
+
+--
+-- Progress of running restores, needs table_log in
+-- shared_preload_libraries. Like pg_stat_progress_*, only
+-- restores of roles the caller has the privileges of are
+-- shown, unless it is a member of pg_read_all_stats
+--
+CREATE FUNCTION table_log_restore_progress(OUT pid INT, OUT datid OID, OUT relid REGCLASS, OUT phase TEXT,
+                                           OUT log_rows_total BIGINT, OUT log_rows_applied BIGINT,
+                                           OUT started TIMESTAMPTZ)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_restore_progress' LANGUAGE C;
+
+CREATE VIEW table_log_stat_progress_restore AS
+    SELECT p.pid, p.datid, d.datname, p.relid, p.phase,
+           p.log_rows_total, p.log_rows_applied, p.started
+      FROM table_log_restore_progress() p
+           LEFT JOIN pg_catalog.pg_database d ON d.oid = p.datid;
+GRANT SELECT ON table_log_stat_progress_restore TO PUBLIC;
+
+--
+-- Net changes of a table between two timestamps
+--
+CREATE FUNCTION table_log_diff(REGCLASS, REGCLASS, TIMESTAMPTZ, TIMESTAMPTZ, TEXT DEFAULT 'trigger_id',
+                               OUT change TEXT, OUT key TEXT, OUT before TEXT, OUT after TEXT)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_diff' LANGUAGE C;
+
+--
+-- Restore the rows matching an expression
+--
+CREATE FUNCTION table_log_restore_where(REGCLASS, REGCLASS, TEXT, TIMESTAMPTZ, TEXT, INT DEFAULT 0, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_restore_where' LANGUAGE C;
+
+--
+-- Replace the history of a log table up to a horizon
+-- with a baseline of the rows at that time
+--
+CREATE FUNCTION table_log_compact(REGCLASS, REGCLASS, TIMESTAMPTZ, TEXT DEFAULT 'trigger_id')
+    RETURNS BIGINT
+    AS 'MODULE_PATHNAME', 'table_log_compact' LANGUAGE C;
+
+--
+-- Keys of a table which don't match the rows replayed from
+-- its log table
+--
+CREATE FUNCTION table_log_verify(REGCLASS, REGCLASS, TEXT DEFAULT 'trigger_id',
+                                 OUT key TEXT, OUT problem TEXT)
+    RETURNS SETOF record
+    AS 'MODULE_PATHNAME', 'table_log_verify' LANGUAGE C;
+
+--
+-- Shared journal for the tables logged in journal mode, see
+-- table_log_init()
+--
+CREATE TABLE table_log_journal (
+    trigger_id       BIGSERIAL   NOT NULL PRIMARY KEY,
+    trigger_relid    REGCLASS    NOT NULL,
+    trigger_mode     VARCHAR(10) NOT NULL,
+    trigger_tuple    VARCHAR(5)  NOT NULL,
+    trigger_changed  TIMESTAMPTZ NOT NULL,
+    trigger_user     VARCHAR(32),
+    trigger_row      JSONB
+) WITH (fillfactor = 100, autovacuum_analyze_scale_factor = 0.02);
+
+CREATE INDEX ON table_log_journal USING brin (trigger_changed);
+-- the entries of one table in log order
+CREATE INDEX ON table_log_journal (trigger_relid, trigger_id);
+
+-- The triggers write to the journal as its owner, users can only
+-- read the entries of tables they can read themselves
+REVOKE ALL ON table_log_journal FROM PUBLIC;
+GRANT SELECT ON table_log_journal TO PUBLIC;
+ALTER TABLE table_log_journal ENABLE ROW LEVEL SECURITY;
+CREATE POLICY table_log_journal_select ON table_log_journal FOR SELECT
+    USING (pg_catalog.has_table_privilege(trigger_relid, 'SELECT'));
+
+SELECT pg_catalog.pg_extension_config_dump('table_log_journal', '');
+SELECT pg_catalog.pg_extension_config_dump('table_log_journal_trigger_id_seq', '');
@@ -17,12 +17,31 @@
 #include "postgres.h"
 #include "fmgr.h"
 #include "executor/spi.h"	/* this is what you need to work with SPI */
+#include "access/sysattr.h"
+#include "access/xact.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_authid.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_trigger.h"
+#include "catalog/pg_type.h"
 #include "commands/trigger.h"	/* -"- and triggers */
 #include "mb/pg_wchar.h"	/* support for the quoting functions */
 #include "miscadmin.h"
+#include "nodes/parsenodes.h"
+#include "nodes/plannodes.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lmgr.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
 #include "lib/stringinfo.h"
+#include "utils/acl.h"
+#include "utils/array.h"
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/fmgroids.h"
 #include "utils/formatting.h"
 #include "utils/guc.h"
 #include <utils/lsyscache.h>
@@ -30,6 +49,11 @@
 #include <utils/timestamp.h>
 #include <utils/syscache.h>
 #include "funcapi.h"
+#include "utils/tuplestore.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/plancache.h"
 
 #if PG_VERSION_NUM >= 90300
 #include "access/htup_details.h"
@@ -67,6 +91,107 @@ PG_MODULE_MAGIC;
  */
 TableLogPartitionId tableLogActivePartitionId = 0;
 
+/*
+ * Number of parallel workers table_log_restore_table() may use.
+ * Zero means to use the classic row-by-row replay of the log.
+ */
+int tableLogRestoreParallelWorkers = 0;
+
+/*
+ * Prepared queries of table_log_row_history(), see
+ * getRowHistoryPlan().
+ */
+static HTAB *tableLogHistoryPlans = NULL;
+
+/*
+ * Columns of original and log tables for table_log_restore_table(),
+ * see getRestoreColumns().
+ */
+static HTAB *tableLogRestoreColumns = NULL;
+
+/*
+ * A row version changed by the current transaction, see
+ * __table_log_coalesced().
+ */
+typedef struct
+{
+	Oid             relid;
+	ItemPointerData tid;
+} TableLogCoalesceKey;
+
+typedef struct
+{
+	TableLogCoalesceKey key;
+
+	/* image before the transaction, NULL if the row was inserted */
+	HeapTuple           original;
+} TableLogCoalesceEntry;
+
+/*
+ * Original images of rows changed more than once in the current
+ * transaction by a coalescing trigger, keyed by their newest version.
+ * Lives in TopTransactionContext.
+ */
+static HTAB *tableLogCoalescePending = NULL;
+
+/*
+ * Progress of a restore, see table_log_restore_progress().
+ */
+typedef struct
+{
+	/* backend running the restore, 0 if the slot is free */
+	int         pid;
+	Oid         datid;
+
+	/* role running the restore, decides who can see it */
+	Oid         userid;
+
+	/* the original table */
+	Oid         relid;
+
+	/* one of TABLE_LOG_PROGRESS_* */
+	int         phase;
+
+	/*
+	 * Estimated number of log entries to replay and
+	 * the number applied.
+	 */
+	int64       log_rows_total;
+	int64       log_rows_applied;
+
+	TimestampTz started;
+} TableLogProgressSlot;
+
+/*
+ * Shared memory for progress reporting, only available if
+ * table_log is loaded by shared_preload_libraries.
+ */
+typedef struct
+{
+	slock_t              mutex;
+	TableLogProgressSlot slots[TABLE_LOG_PROGRESS_SLOTS];
+} TableLogProgressShared;
+
+static TableLogProgressShared *tableLogProgress = NULL;
+
+/*
+ * Slot of the restore running in this backend, if any.
+ */
+static TableLogProgressSlot *tableLogMyProgress = NULL;
+
+static const char *const tableLogProgressPhases[] = {
+	"validating",
+	"copying base",
+	"scanning log",
+	"replaying",
+	"bulk loading"
+};
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+#endif
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
 /*
  * table_log restore descriptor.
  *
@@ -110,6 +235,18 @@ typedef struct
 	 */
 	int use_session_user;
 
+	/*
+	 * Qualified name of the shared journal the changes are
+	 * written to in journal mode, NULL otherwise
+	 */
+	char *journal_ident;
+
+	/*
+	 * Owner of the journal, users can't write to it
+	 * themselves
+	 */
+	Oid journal_owner;
+
 } TableLogDescr;
 
 /*
@@ -169,6 +306,12 @@ typedef struct
 	 */
 	char *pkey_log;
 
+	/*
+	 * What the trigger writing the log table logs,
+	 * see TABLE_LOG_MODE_FULL.
+	 */
+	int log_mode;
+
 	/*
 	 * OID of restore table.
 	 */
@@ -186,6 +329,192 @@ typedef struct
 	};
 } TableLogRestoreDescr;
 
+/*
+ * table_log state query descriptor.
+ *
+ * Describes a set-based query which computes the state of a logged
+ * table at a given point in time, instead of replaying each log
+ * row separately. See appendRestoreStateQuery() for details.
+ */
+typedef struct
+{
+	/*
+	 * Quoted (and possibly qualified) identifier of the relation
+	 * the restore starts from, e.g. the original table for a backward
+	 * restore or a snapshot. NULL starts from an empty table.
+	 */
+	char *base_ident;
+
+	/*
+	 * Quoted (and possibly qualified) identifier of the
+	 * log table.
+	 */
+	char *log_ident;
+
+	/*
+	 * Quoted column name of the primary key of the log table,
+	 * which defines the order of the log entries.
+	 */
+	char *log_pkey;
+
+	/*
+	 * Quoted, comma separated list of the columns of the
+	 * original table.
+	 */
+	char *col_list;
+
+	/*
+	 * List of (unquoted) primary key column names of the original table.
+	 */
+	List *pk_attr_names;
+
+	/*
+	 * Timestamp to restore, already quoted as a literal.
+	 */
+	char *timestamp;
+
+	/*
+	 * Restore method, 0 = roll forward from the base,
+	 * 1 = roll backward from the base.
+	 */
+	int method;
+
+	/*
+	 * Additional condition on the log primary key, restricting
+	 * the log entries to those not yet contained in the base
+	 * (e.g. "> 4711"), or NULL.
+	 */
+	char *log_window;
+
+	/*
+	 * Values of a single key to restore or NULL to restore
+	 * all keys.
+	 */
+	char **search_pkey_values;
+
+	/*
+	 * Query returning the keys to restore, in the order of the
+	 * primary key columns, or NULL. See table_log_restore_keys().
+	 */
+	char *search_keys;
+
+	/*
+	 * Expression on the columns of the original table, restricting
+	 * the restore to the rows matching it, or NULL. See
+	 * table_log_restore_where().
+	 */
+	char *filter;
+
+	/*
+	 * What the log contains, see TABLE_LOG_MODE_FULL. Rolling
+	 * backward a chain log takes the images of the entries before
+	 * the timestamp.
+	 */
+	int log_mode;
+} TableLogStateQuery;
+
+/*
+ * table_log restore candidate.
+ *
+ * Describes one possible starting point of a restore together
+ * with the planner's estimate of the work needed to restore from it.
+ * See getRestoreCandidates() for details.
+ */
+typedef struct
+{
+	/*
+	 * Quoted (and possibly qualified) identifier of the relation
+	 * to start from, NULL to start from an empty table.
+	 */
+	char *base_ident;
+
+	/*
+	 * Replay direction, 0 = forward, 1 = backward.
+	 */
+	int method;
+
+	/*
+	 * Restriction of the log entries to apply, see
+	 * TableLogStateQuery.
+	 */
+	char *log_window;
+
+	/*
+	 * Estimated number of rows to copy from the base relation.
+	 */
+	float8 base_rows;
+
+	/*
+	 * Estimated number of log entries to apply.
+	 */
+	float8 log_rows;
+} TableLogRestoreCandidate;
+
+/*
+ * Hash key of the caches kept per pair of original and
+ * log table.
+ */
+typedef struct
+{
+	Oid orig_relid;
+	Oid log_relid;
+} TableLogRelPair;
+
+/*
+ * Prepared query of table_log_row_history() for a pair of
+ * original and log table.
+ */
+typedef struct
+{
+	/* hash key, must be first */
+	TableLogRelPair key;
+
+	/*
+	 * Query text the plan was prepared for. A call asking
+	 * for other columns replaces the plan.
+	 */
+	char *query;
+
+	/*
+	 * Saved plan, the plan cache takes care to
+	 * replan after DDL on the tables involved.
+	 */
+	SPIPlanPtr plan;
+} TableLogHistoryPlan;
+
+/*
+ * Columns of an original table and its log table as needed
+ * by table_log_restore_table(), see getRestoreColumns().
+ */
+typedef struct
+{
+	/* hash key, must be first */
+	TableLogRelPair key;
+
+	/*
+	 * Cleared by the relcache invalidation callback when
+	 * either of the tables changes.
+	 */
+	bool valid;
+
+	/*
+	 * Number and names of the (not dropped) columns of the
+	 * original table, in column order.
+	 */
+	int    number_columns;
+	char **col_names;
+
+	/*
+	 * The same names quoted and comma separated.
+	 */
+	char  *col_list;
+
+	/*
+	 * Number of (not dropped) columns of the log table.
+	 */
+	int    number_columns_log;
+} TableLogRestoreColumns;
+
 #define DESCR_TRIGDATA(a) \
 	(a).trigdata
 
@@ -228,37 +557,73 @@ typedef struct
 void _PG_init(void);
 Datum table_log(PG_FUNCTION_ARGS);
 Datum table_log_basic(PG_FUNCTION_ARGS);
+Datum table_log_chain(PG_FUNCTION_ARGS);
 Datum table_log_restore_table(PG_FUNCTION_ARGS);
+Datum table_log_explain_restore(PG_FUNCTION_ARGS);
+Datum table_log_as_of(PG_FUNCTION_ARGS);
+Datum table_log_row_history(PG_FUNCTION_ARGS);
+Datum table_log_rewind(PG_FUNCTION_ARGS);
+Datum table_log_refresh_restore(PG_FUNCTION_ARGS);
+Datum table_log_restore_keys(PG_FUNCTION_ARGS);
+Datum table_log_restore_tables(PG_FUNCTION_ARGS);
+Datum table_log_export(PG_FUNCTION_ARGS);
+Datum table_log_import(PG_FUNCTION_ARGS);
+Datum table_log_restore_progress(PG_FUNCTION_ARGS);
+Datum table_log_diff(PG_FUNCTION_ARGS);
+Datum table_log_restore_where(PG_FUNCTION_ARGS);
+Datum table_log_compact(PG_FUNCTION_ARGS);
+Datum table_log_verify(PG_FUNCTION_ARGS);
 static char *do_quote_ident(char *iptr);
 static char *do_quote_literal(char *iptr);
 static void __table_log (TableLogDescr *descr,
 						 char          *changed_mode,
 						 char          *changed_tuple,
 						 HeapTuple      tuple);
+static void __table_log_journal(TableLogDescr *descr,
+								char          *changed_mode,
+								char          *changed_tuple,
+								HeapTuple      tuple);
+static void __table_log_coalesced(TableLogDescr *descr,
+								  int log_mode);
+static void __table_log_chain(TableLogDescr *descr,
+							  HeapTuple oldtuple,
+							  HeapTuple newtuple);
+static Bitmapset *getRelationKeyAttrs(Relation rel);
+static bool isTupleSuperseded(HeapTuple tuple);
+static void tableLogCoalesceXactCallback(XactEvent event, void *arg);
 static void table_log_prepare(TableLogDescr *descr);
+static void takeTruncateSnapshot(TableLogDescr *descr, Oid ext_namespace);
 static void table_log_finalize(void);
 static void __table_log_restore_table_insert(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i);
 static void __table_log_restore_table_update(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i,
-											 char *old_key_string);
+											 char **old_pkey_values);
 static void __table_log_restore_table_delete(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i);
+static char **getPrimaryKeyValues(SPITupleTable *spi_tuptable,
+								  int *col_pkeys,
+								  int num_pkeys,
+								  int i);
+static char **splitPrimaryKeyString(char *key_string, int num_pkeys);
+static void appendPrimaryKeyPredicate(StringInfo buf,
+									  List *pk_attr_names,
+									  char **pk_values);
 static char *__table_log_varcharout(VarChar *s);
 static int count_columns (TupleDesc tupleDesc);
 static void mapPrimaryKeyColumnNames(TableLogRestoreDescr *restore_descr);
@@ -269,19 +634,136 @@ static void setTableLogRestoreDescr(TableLogRestoreDescr *restore_descr,
 									char *table_log_pkey,
 									char *table_restore);
 static void getRelationPrimaryKeyColumns(TableLogRestoreDescr *restore_descr);
+static int getLogMode(TableLogRestoreDescr *restore_descr);
+static void setTableLogRestoreDescrByOid(TableLogRestoreDescr *restore_descr,
+										 Oid orig_relid,
+										 Oid log_relid);
+static void appendKeyColumnList(StringInfo buf,
+								List *pk_attr_names,
+								const char *qualifier);
+static void appendLogWindow(StringInfo buf,
+							TableLogStateQuery *state,
+							const char *qualifier);
+static void appendTruncateMarker(StringInfo buf,
+								 List *pk_attr_names,
+								 const char *qualifier);
+static bool logHasTruncate(const char *log_ident,
+						   List *pk_attr_names,
+						   const char *condition);
+static void appendRestoreStateQuery(StringInfo buf,
+									TableLogStateQuery *state);
+static void appendChainStateQuery(StringInfo buf,
+								  TableLogStateQuery *state);
+static void checkLogChain(TableLogStateQuery *state);
+static int setRestoreParallelWorkers(int workers);
+static void registerRestoreTable(TableLogRestoreDescr *restore_descr,
+								 TableLogStateQuery *state,
+								 Oid ext_namespace);
+static void checkRefreshIsolation(const char *caller);
+static float8 estimateQueryRows(const char *query);
+static void appendSearchKeyFilter(StringInfo buf,
+								  TableLogStateQuery *state,
+								  const char *keyword);
+static void appendRestoreFilter(StringInfo buf,
+								TableLogStateQuery *state,
+								const char *keyword);
+static List *getRestoreCandidates(TableLogRestoreDescr *restore_descr,
+								  TableLogStateQuery *state,
+								  Oid ext_namespace,
+								  TableLogRestoreCandidate **cheapest);
+static void getRestoreSnapshot(TableLogRestoreDescr *restore_descr,
+							   TableLogStateQuery *state,
+							   Oid ext_namespace);
+static SPIPlanPtr getRowHistoryPlan(TableLogRelPair *key,
+									char *query,
+									int nargs,
+									Oid *argtypes);
+static List *getRelationColumnNames(Oid relid);
+static TableLogRestoreColumns *getRestoreColumns(Oid orig_relid,
+												 Oid log_relid);
+static void invalidateRestoreColumns(Datum arg, Oid relid);
+static char *getSearchKeysQuery(TableLogRestoreDescr *restore_descr,
+								Oid keys_type,
+								Datum keys);
+static char *getNewRestoreTableIdent(text *name);
+static const char *getRestoreTableOption(int not_temporarly);
+static void createRestoreIndex(const char *restore_ident,
+							   List *pk_attr_names);
+static void setCheapestRestoreState(TableLogStateQuery *state,
+									TableLogRestoreDescr *restore_descr,
+									Datum timestamp,
+									char *search_keys,
+									char *filter,
+									Oid ext_namespace);
+static char *checkRestoreFilter(text *filter);
+static char *getExportPath(text *path);
+static void writeExportInt32(FILE *file, int32 value, const char *path);
+static void writeExportBytes(FILE *file, const char *data, int32 len,
+							 const char *path);
+static void writeExportString(FILE *file, const char *str, const char *path);
+static int32 readExportInt32(FILE *file, const char *path);
+static void readExportBytes(FILE *file, char *data, int32 len,
+							const char *path);
+static char *readExportString(FILE *file, const char *path);
+#if PG_VERSION_NUM >= 150000
+static void tableLogShmemRequest(void);
+#endif
+static void tableLogShmemStartup(void);
+static void tableLogProgressXactCallback(XactEvent event, void *arg);
+static void startRestoreProgress(Oid relid);
+static void setRestoreProgressPhase(int phase, int64 log_rows_total);
+static void updateRestoreProgress(int64 log_rows_applied);
+static void endRestoreProgress(void);
+static bool canSeeRestoreProgress(Oid userid);
+static void putDiffRow(Tuplestorestate *tupstore,
+					   TupleDesc tupdesc,
+					   char *key,
+					   char *before,
+					   char *after);
+static int64 applyLogDelta(char *target_ident,
+						   char *log_ident,
+						   char *log_pkey,
+						   List *pk_attr_names,
+						   List *col_names,
+						   char *log_window,
+						   bool forward);
 
 /* this is a V1 (new) function */
 /* the trigger function */
 PG_FUNCTION_INFO_V1(table_log);
 PG_FUNCTION_INFO_V1(table_log_basic);
+PG_FUNCTION_INFO_V1(table_log_chain);
 PG_FUNCTION_INFO_V1(table_log_forward);
-/* build only, if the 'Table Function API' is available */
-#ifdef FUNCAPI_H_not_implemented
-/* restore one single column */
-PG_FUNCTION_INFO_V1(table_log_show_column);
-#endif /* FUNCAPI_H */
 /* restore a full table */
 PG_FUNCTION_INFO_V1(table_log_restore_table);
+/* show the estimated cost of a restore */
+PG_FUNCTION_INFO_V1(table_log_explain_restore);
+/* return the rows of a table at a timestamp */
+PG_FUNCTION_INFO_V1(table_log_as_of);
+/* return all versions of a single row */
+PG_FUNCTION_INFO_V1(table_log_row_history);
+/* rewind a table in place */
+PG_FUNCTION_INFO_V1(table_log_rewind);
+/* move a restore table to another timestamp */
+PG_FUNCTION_INFO_V1(table_log_refresh_restore);
+/* restore a set of keys */
+PG_FUNCTION_INFO_V1(table_log_restore_keys);
+/* restore several tables to the same point in time */
+PG_FUNCTION_INFO_V1(table_log_restore_tables);
+/* write a range of a log table into a file */
+PG_FUNCTION_INFO_V1(table_log_export);
+/* load an export file into a log table */
+PG_FUNCTION_INFO_V1(table_log_import);
+/* show the progress of running restores */
+PG_FUNCTION_INFO_V1(table_log_restore_progress);
+/* net changes between two timestamps */
+PG_FUNCTION_INFO_V1(table_log_diff);
+/* restore the rows matching an expression */
+PG_FUNCTION_INFO_V1(table_log_restore_where);
+/* replace the history up to a horizon with a baseline */
+PG_FUNCTION_INFO_V1(table_log_compact);
+/* check the log against the original table */
+PG_FUNCTION_INFO_V1(table_log_verify);
 
 /*
  * Initialize table_log module and various internal
@@ -301,6 +783,195 @@ void _PG_init(void)
 							NULL,
 							NULL,
 							NULL);
+
+	DefineCustomIntVariable("table_log.restore_parallel_workers",
+							"Sets the number of parallel workers used by table_log_restore_table().",
+							"Zero replays the log row by row, any other value "
+							"restores the table with a set-based query which "
+							"may use up to this many parallel workers.",
+							&tableLogRestoreParallelWorkers,
+							0,
+							0,
+							1024,
+							PGC_USERSET,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	CacheRegisterRelcacheCallback(invalidateRestoreColumns, (Datum) 0);
+	RegisterXactCallback(tableLogProgressXactCallback, NULL);
+	RegisterXactCallback(tableLogCoalesceXactCallback, NULL);
+
+	/*
+	 * Progress reporting of restores needs shared memory, which
+	 * can only be requested when loaded at server start.
+	 */
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+#if PG_VERSION_NUM >= 150000
+	prev_shmem_request_hook = shmem_request_hook;
+	shmem_request_hook      = tableLogShmemRequest;
+#else
+	RequestAddinShmemSpace(sizeof(TableLogProgressShared));
+#endif
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook      = tableLogShmemStartup;
+}
+
+#if PG_VERSION_NUM >= 150000
+/*
+ * Requests the shared memory for progress reporting.
+ */
+static void tableLogShmemRequest(void)
+{
+	if (prev_shmem_request_hook)
+		prev_shmem_request_hook();
+
+	RequestAddinShmemSpace(sizeof(TableLogProgressShared));
+}
+#endif
+
+/*
+ * Attaches to (and initializes) the shared memory for
+ * progress reporting.
+ */
+static void tableLogShmemStartup(void)
+{
+	bool found;
+
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+	tableLogProgress = ShmemInitStruct("table_log restore progress",
+									   sizeof(TableLogProgressShared),
+									   &found);
+
+	if (!found)
+	{
+		memset(tableLogProgress, 0, sizeof(TableLogProgressShared));
+		SpinLockInit(&tableLogProgress->mutex);
+	}
+
+	LWLockRelease(AddinShmemInitLock);
+}
+
+/*
+ * Releases the progress slot of a restore when its transaction
+ * ends, also if the restore failed.
+ */
+static void tableLogProgressXactCallback(XactEvent event, void *arg)
+{
+	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT
+		|| event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT)
+	{
+		endRestoreProgress();
+	}
+}
+
+/*
+ * Starts reporting the progress of a restore of relid. Does nothing
+ * without shared memory or if all slots are in use.
+ */
+static void startRestoreProgress(Oid relid)
+{
+	int i;
+
+	if (tableLogProgress == NULL)
+		return;
+
+	endRestoreProgress();
+
+	SpinLockAcquire(&tableLogProgress->mutex);
+
+	for (i = 0; i < TABLE_LOG_PROGRESS_SLOTS; i++)
+	{
+		TableLogProgressSlot *slot = &tableLogProgress->slots[i];
+
+		if (slot->pid != 0)
+			continue;
+
+		slot->pid              = MyProcPid;
+		slot->datid            = MyDatabaseId;
+		slot->userid           = GetUserId();
+		slot->relid            = relid;
+		slot->phase            = TABLE_LOG_PROGRESS_VALIDATING;
+		slot->log_rows_total   = 0;
+		slot->log_rows_applied = 0;
+		slot->started          = GetCurrentTimestamp();
+
+		tableLogMyProgress = slot;
+		break;
+	}
+
+	SpinLockRelease(&tableLogProgress->mutex);
+}
+
+/*
+ * Reports the next phase of the restore, together with the
+ * estimated number of log entries to replay if known (or -1).
+ */
+static void setRestoreProgressPhase(int phase, int64 log_rows_total)
+{
+	if (tableLogMyProgress == NULL)
+		return;
+
+	SpinLockAcquire(&tableLogProgress->mutex);
+	tableLogMyProgress->phase = phase;
+	if (log_rows_total >= 0)
+		tableLogMyProgress->log_rows_total = log_rows_total;
+	SpinLockRelease(&tableLogProgress->mutex);
+}
+
+/*
+ * Reports the number of log entries applied so far. This takes the
+ * spinlock shared by all backends, so replaying calls it only every
+ * TABLE_LOG_PROGRESS_INTERVAL entries.
+ */
+static void updateRestoreProgress(int64 log_rows_applied)
+{
+	if (tableLogMyProgress == NULL)
+		return;
+
+	SpinLockAcquire(&tableLogProgress->mutex);
+	tableLogMyProgress->log_rows_applied = log_rows_applied;
+	SpinLockRelease(&tableLogProgress->mutex);
+}
+
+/*
+ * Stops reporting the progress of the restore.
+ */
+static void endRestoreProgress(void)
+{
+	if (tableLogMyProgress == NULL)
+		return;
+
+	SpinLockAcquire(&tableLogProgress->mutex);
+	tableLogMyProgress->pid = 0;
+	SpinLockRelease(&tableLogProgress->mutex);
+
+	tableLogMyProgress = NULL;
+}
+
+/*
+ * Whether the current user may see the progress of a restore run
+ * by userid, the same check pg_stat_get_progress_info() does.
+ */
+static bool canSeeRestoreProgress(Oid userid)
+{
+	if (has_privs_of_role(GetUserId(), userid))
+		return true;
+
+#if PG_VERSION_NUM >= 140000
+	return has_privs_of_role(GetUserId(), ROLE_PG_READ_ALL_STATS);
+#elif PG_VERSION_NUM >= 100000
+	return is_member_of_role(GetUserId(), DEFAULT_ROLE_READ_ALL_STATS);
+#else
+	return superuser();
+#endif
 }
 
 /*
@@ -400,6 +1071,8 @@ static void initTableLogDescr(TableLogDescr *descr,
 	descr->ident_log.schema   = NULL;
 	descr->ident_log.relname  = NULL;
 	descr->use_session_user   = 0;
+	descr->journal_ident      = NULL;
+	descr->journal_owner      = InvalidOid;
 }
 
 /*
@@ -416,16 +1089,27 @@ static void table_log_prepare(TableLogDescr *descr)
 	int         ret;
 	StringInfo  query;
 
-	/* must only be called for ROW trigger */
-	if (TRIGGER_FIRED_FOR_STATEMENT(descr->trigdata->tg_event))
+	if (TRIGGER_FIRED_BY_TRUNCATE(descr->trigdata->tg_event))
 	{
-		elog(ERROR, "table_log: can't process STATEMENT events");
+		/* must be called BEFORE, the snapshot needs the rows */
+		if (!TRIGGER_FIRED_BEFORE(descr->trigdata->tg_event))
+		{
+			elog(ERROR, "table_log: TRUNCATE must be fired before event");
+		}
 	}
-
-	/* must only be called AFTER */
-	if (TRIGGER_FIRED_BEFORE(descr->trigdata->tg_event))
+	else
 	{
-		elog(ERROR, "table_log: must be fired after event");
+		/* must only be called for ROW trigger */
+		if (TRIGGER_FIRED_FOR_STATEMENT(descr->trigdata->tg_event))
+		{
+			elog(ERROR, "table_log: can't process STATEMENT events");
+		}
+
+		/* must only be called AFTER */
+		if (TRIGGER_FIRED_BEFORE(descr->trigdata->tg_event))
+		{
+			elog(ERROR, "table_log: must be fired after event");
+		}
 	}
 
 	/* now connect to SPI manager */
@@ -465,6 +1149,34 @@ static void table_log_prepare(TableLogDescr *descr)
 	/* name of the log table */
 	descr->ident_log.relname = getActiveLogTable(DESCR_TRIGDATA((*descr)));
 
+	/*
+	 * In journal mode the log table is a view over the journal,
+	 * which lives in the schema of the trigger function.
+	 */
+	if (DESCR_TRIGDATA_NARGS((*descr)) > 3
+		&& strcmp(DESCR_TRIGDATA_GETARG((*descr), 3), "JOURNAL") == 0)
+	{
+		Oid       ext_namespace = get_func_namespace(DESCR_TRIGDATA((*descr))->tg_trigger->tgfoid);
+		Oid       journal_relid;
+		HeapTuple classTuple;
+
+		descr->journal_ident = psprintf("%s.table_log_journal",
+										do_quote_ident(get_namespace_name(ext_namespace)));
+
+		journal_relid = get_relname_relid("table_log_journal", ext_namespace);
+		classTuple    = SearchSysCache1(RELOID, ObjectIdGetDatum(journal_relid));
+
+		if (!HeapTupleIsValid(classTuple))
+		{
+			elog(ERROR, "table_log: journal %s not found", descr->journal_ident);
+		}
+
+		descr->journal_owner = ((Form_pg_class) GETSTRUCT(classTuple))->relowner;
+		ReleaseSysCache(classTuple);
+
+		elog(DEBUG2, "will write to journal %s", descr->journal_ident);
+	}
+
 	/* should we write the current user? */
 	if (DESCR_TRIGDATA_NARGS((*descr)) > 1)
 	{
@@ -483,6 +1195,13 @@ static void table_log_prepare(TableLogDescr *descr)
 		 quote_identifier(descr->ident_log.schema),
 		 quote_identifier(descr->ident_log.relname));
 
+	/*
+	 * The journal keeps whole rows, the view over it only needs
+	 * to match the original table for restores.
+	 */
+	if (descr->journal_ident != NULL)
+		return;
+
 	/* get the number columns in the table */
 	query = makeStringInfo();
 	appendStringInfo(query, "%s.%s",
@@ -544,13 +1263,14 @@ static void table_log_finalize()
 }
 
 /*
- * table_log_forward
+ * table_log_basic
  *
  * Trigger function with the same core functionality
  * than table_log(), but without the possibility to do
- * backward log replay. This means that NEW tuples for UPDATE
+ * forward log replay. This means that NEW tuples for UPDATE
  * actions aren't logged, which makes the log table much smaller
- * in case someone have a heavy updated source table.
+ * in case someone have a heavy updated source table. Restores
+ * replay such a log backward from the original table.
  */
 Datum table_log_basic(PG_FUNCTION_ARGS)
 {
@@ -579,9 +1299,15 @@ Datum table_log_basic(PG_FUNCTION_ARGS)
 	 */
 	table_log_prepare(&log_descr);
 
-	if (TRIGGER_FIRED_BY_INSERT(DESCR_TRIGDATA(log_descr)->tg_event))
+	if (DESCR_TRIGDATA(log_descr)->tg_trigger->tgdeferrable &&
+		TRIGGER_FIRED_FOR_ROW(DESCR_TRIGDATA(log_descr)->tg_event))
 	{
-		/* trigger called from INSERT */
+		/* deferred constraint trigger, log the net change only */
+		__table_log_coalesced(&log_descr, TABLE_LOG_MODE_BASIC);
+	}
+	else if (TRIGGER_FIRED_BY_INSERT(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/* trigger called from INSERT */
 		elog(DEBUG2, "mode: INSERT -> new");
 
 		__table_log(&log_descr,
@@ -608,6 +1334,19 @@ Datum table_log_basic(PG_FUNCTION_ARGS)
 					"old",
 					DESCR_TRIGDATA_GET_TUPLE(log_descr));
 	}
+	else if (TRIGGER_FIRED_BY_TRUNCATE(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/* as table_log(), restores roll back over the marker from the snapshot */
+		elog(DEBUG2, "mode: TRUNCATE -> old");
+
+		takeTruncateSnapshot(&log_descr,
+							 get_func_namespace(fcinfo->flinfo->fn_oid));
+
+		__table_log(&log_descr,
+					"TRUNCATE",
+					"old",
+					NULL);
+	}
 	else
 	{
 		elog(ERROR, "trigger fired by unknown event");
@@ -659,7 +1398,13 @@ Datum table_log(PG_FUNCTION_ARGS)
 	table_log_prepare(&log_descr);
 
 
-	if (TRIGGER_FIRED_BY_INSERT(DESCR_TRIGDATA(log_descr)->tg_event))
+	if (DESCR_TRIGDATA(log_descr)->tg_trigger->tgdeferrable &&
+		TRIGGER_FIRED_FOR_ROW(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/* deferred constraint trigger, log the net change only */
+		__table_log_coalesced(&log_descr, TABLE_LOG_MODE_FULL);
+	}
+	else if (TRIGGER_FIRED_BY_INSERT(DESCR_TRIGDATA(log_descr)->tg_event))
 	{
 		/* trigger called from INSERT */
 		elog(DEBUG2, "mode: INSERT -> new");
@@ -696,6 +1441,99 @@ Datum table_log(PG_FUNCTION_ARGS)
 					"old",
 					DESCR_TRIGDATA_GET_TUPLE(log_descr));
 	}
+	else if (TRIGGER_FIRED_BY_TRUNCATE(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/*
+		 * trigger called from TRUNCATE: keep the rows in a snapshot,
+		 * so restores can roll back over the marker
+		 */
+		elog(DEBUG2, "mode: TRUNCATE -> old");
+
+		takeTruncateSnapshot(&log_descr,
+							 get_func_namespace(fcinfo->flinfo->fn_oid));
+
+		__table_log(&log_descr,
+					"TRUNCATE",
+					"old",
+					NULL);
+	}
+	else
+	{
+		elog(ERROR, "trigger fired by unknown event");
+	}
+
+	elog(DEBUG2, "cleanup, trigger done");
+
+	table_log_finalize();
+
+	/* return trigger data */
+	return PointerGetDatum(DESCR_TRIGDATA_GET_TUPLE(log_descr));
+}
+
+/*
+ * table_log_chain
+ *
+ * Trigger function logging a single image per row version: the new
+ * image of an INSERT or UPDATE and a tombstone with the key for a
+ * DELETE. The old image of a change is the entry before it of the same
+ * key, so the log of an update heavy table is about half the size of
+ * the one written by table_log(), while restores still work in both
+ * directions. See __table_log_chain().
+ */
+Datum table_log_chain(PG_FUNCTION_ARGS)
+{
+	TableLogDescr  log_descr;
+
+	elog(DEBUG2, "start table_log_chain()");
+
+	/* called by trigger manager? */
+	if (!CALLED_AS_TRIGGER(fcinfo))
+	{
+		elog(ERROR, "table_log: not fired by trigger manager");
+	}
+
+	initTableLogDescr(&log_descr,
+					  (TriggerData *) fcinfo->context);
+
+	table_log_prepare(&log_descr);
+
+	if (DESCR_TRIGDATA(log_descr)->tg_trigger->tgdeferrable &&
+		TRIGGER_FIRED_FOR_ROW(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/* deferred constraint trigger, log the net change only */
+		__table_log_coalesced(&log_descr, TABLE_LOG_MODE_CHAIN);
+	}
+	else if (TRIGGER_FIRED_BY_INSERT(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		__table_log_chain(&log_descr,
+						  NULL,
+						  DESCR_TRIGDATA_GET_TUPLE(log_descr));
+	}
+	else if (TRIGGER_FIRED_BY_UPDATE(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		__table_log_chain(&log_descr,
+						  DESCR_TRIGDATA_GET_TUPLE(log_descr),
+						  DESCR_TRIGDATA_GET_NEWTUPLE(log_descr));
+	}
+	else if (TRIGGER_FIRED_BY_DELETE(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		__table_log_chain(&log_descr,
+						  DESCR_TRIGDATA_GET_TUPLE(log_descr),
+						  NULL);
+	}
+	else if (TRIGGER_FIRED_BY_TRUNCATE(DESCR_TRIGDATA(log_descr)->tg_event))
+	{
+		/* as table_log(), restores roll back over the marker from the snapshot */
+		elog(DEBUG2, "mode: TRUNCATE -> old");
+
+		takeTruncateSnapshot(&log_descr,
+							 get_func_namespace(fcinfo->flinfo->fn_oid));
+
+		__table_log(&log_descr,
+					"TRUNCATE",
+					"old",
+					NULL);
+	}
 	else
 	{
 		elog(ERROR, "trigger fired by unknown event");
@@ -709,6 +1547,381 @@ Datum table_log(PG_FUNCTION_ARGS)
 	return PointerGetDatum(DESCR_TRIGDATA_GET_TUPLE(log_descr));
 }
 
+/*
+ * Logs the net change of a row by the current transaction instead
+ * of every single change. Called by a deferred constraint trigger,
+ * so all events of the transaction are processed at commit, in the
+ * order they happened.
+ *
+ * The versions of a row are followed by their ctid: the image of a
+ * row before the transaction is remembered while the row is changed
+ * again later in the transaction, and written together with the final
+ * image at the last change. Thus a row inserted and deleted again
+ * leaves no trace, a chain of updates becomes a single old/new pair.
+ * If the trigger fires immediately (SET CONSTRAINTS ... IMMEDIATE),
+ * every change is logged as usual.
+ *
+ * log_mode tells what to log of the net change, see
+ * TABLE_LOG_MODE_FULL.
+ */
+static void __table_log_coalesced(TableLogDescr *descr,
+								  int log_mode)
+{
+	TriggerData           *trigdata = DESCR_TRIGDATA(*descr);
+	TableLogCoalesceKey    key;
+	TableLogCoalesceEntry *entry;
+	HeapTuple              original = NULL;
+	HeapTuple              newtuple = NULL;
+	bool                   inserted = false;
+	bool                   found;
+
+	if (tableLogCoalescePending == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize   = sizeof(TableLogCoalesceKey);
+		ctl.entrysize = sizeof(TableLogCoalesceEntry);
+		ctl.hcxt      = TopTransactionContext;
+
+		tableLogCoalescePending = hash_create("table_log coalesced rows",
+											  256, &ctl,
+											  HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	/* the key contains padding */
+	memset(&key, 0, sizeof(key));
+	key.relid = RelationGetRelid(trigdata->tg_relation);
+
+	if (TRIGGER_FIRED_BY_INSERT(trigdata->tg_event))
+	{
+		inserted = true;
+		newtuple = trigdata->tg_trigtuple;
+	}
+	else
+	{
+		/* UPDATE or DELETE, was this version already changed before? */
+		key.tid = trigdata->tg_trigtuple->t_self;
+		entry   = (TableLogCoalesceEntry *) hash_search(tableLogCoalescePending,
+														&key, HASH_REMOVE, &found);
+
+		if (found)
+		{
+			original = entry->original;
+			inserted = (original == NULL);
+		}
+		else
+		{
+			original = trigdata->tg_trigtuple;
+		}
+
+		if (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event))
+			newtuple = trigdata->tg_newtuple;
+	}
+
+	if (newtuple != NULL && isTupleSuperseded(newtuple))
+	{
+		/* changed again later, hand the original on to the next version */
+		key.tid = newtuple->t_self;
+		entry   = (TableLogCoalesceEntry *) hash_search(tableLogCoalescePending,
+														&key, HASH_ENTER, &found);
+
+		if (original != NULL)
+		{
+			MemoryContext oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+
+			entry->original = heap_copytuple(original);
+			MemoryContextSwitchTo(oldcontext);
+		}
+		else
+		{
+			entry->original = NULL;
+		}
+
+		elog(DEBUG2, "row changed again later in this transaction");
+		return;
+	}
+
+	if (newtuple == NULL && inserted)
+	{
+		/* inserted and deleted again by this transaction, nothing to log */
+	}
+	else if (log_mode == TABLE_LOG_MODE_CHAIN)
+	{
+		__table_log_chain(descr, inserted ? NULL : original, newtuple);
+	}
+	else if (newtuple == NULL)
+	{
+		__table_log(descr, "DELETE", "old", original);
+	}
+	else if (inserted)
+	{
+		__table_log(descr, "INSERT", "new", newtuple);
+	}
+	else
+	{
+		__table_log(descr, "UPDATE", "old", original);
+
+		if (log_mode == TABLE_LOG_MODE_FULL)
+			__table_log(descr, "UPDATE", "new", newtuple);
+	}
+}
+
+/*
+ * Logs a change in chain mode, see table_log_chain(): the new image
+ * of an INSERT or UPDATE and a tombstone holding only the key for a
+ * DELETE. oldtuple is NULL for an INSERT, newtuple for a DELETE.
+ *
+ * An UPDATE changing the primary key is logged as DELETE of the old
+ * key and INSERT of the new one, so the log entries of each key form
+ * a chain of their own, each old image being the entry before.
+ */
+static void __table_log_chain(TableLogDescr *descr,
+							  HeapTuple oldtuple,
+							  HeapTuple newtuple)
+{
+	Relation   rel     = DESCR_TRIGDATA(*descr)->tg_relation;
+	TupleDesc  tupdesc = RelationGetDescr(rel);
+	Bitmapset *keys;
+	HeapTuple  tombstone;
+	Datum     *values;
+	bool      *nulls;
+	int        attnum;
+
+	if (oldtuple == NULL)
+	{
+		elog(DEBUG2, "mode: INSERT -> new");
+		__table_log(descr, "INSERT", "new", newtuple);
+		return;
+	}
+
+	keys = getRelationKeyAttrs(rel);
+
+	if (newtuple != NULL)
+	{
+		bool key_changed = false;
+
+		attnum = -1;
+
+		/*
+		 * Compare the binary values, like HOT does for indexed
+		 * columns: a key changed into an equal but different
+		 * value is logged as a new chain, which is still correct.
+		 */
+		while (!key_changed && (attnum = bms_next_member(keys, attnum)) >= 0)
+		{
+			Form_pg_attribute att = TupleDescAttr(tupdesc, attnum - 1);
+			bool              old_isnull;
+			bool              new_isnull;
+			Datum             old_value = heap_getattr(oldtuple, attnum, tupdesc, &old_isnull);
+			Datum             new_value = heap_getattr(newtuple, attnum, tupdesc, &new_isnull);
+
+			key_changed = (old_isnull || new_isnull
+						   || !datumIsEqual(old_value, new_value,
+											att->attbyval, att->attlen));
+		}
+
+		if (!key_changed)
+		{
+			elog(DEBUG2, "mode: UPDATE -> new");
+			__table_log(descr, "UPDATE", "new", newtuple);
+			return;
+		}
+	}
+
+	/* the tombstone keeps the key only */
+	values = (Datum *) palloc(tupdesc->natts * sizeof(Datum));
+	nulls  = (bool *) palloc(tupdesc->natts * sizeof(bool));
+
+	heap_deform_tuple(oldtuple, tupdesc, values, nulls);
+
+	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	{
+		if (!bms_is_member(attnum, keys))
+			nulls[attnum - 1] = true;
+	}
+
+	tombstone = heap_form_tuple(tupdesc, values, nulls);
+
+	elog(DEBUG2, "mode: DELETE -> old");
+	__table_log(descr, "DELETE", "old", tombstone);
+
+	if (newtuple != NULL)
+	{
+		elog(DEBUG2, "mode: INSERT -> new");
+		__table_log(descr, "INSERT", "new", newtuple);
+	}
+
+	heap_freetuple(tombstone);
+	pfree(values);
+	pfree(nulls);
+}
+
+/*
+ * Returns the attribute numbers of the primary key columns of rel,
+ * which table_log_chain() needs to write tombstones.
+ */
+static Bitmapset *getRelationKeyAttrs(Relation rel)
+{
+	Bitmapset *keys = NULL;
+#if PG_VERSION_NUM >= 100000
+	Bitmapset *pkey_attrs;
+	int        attnum = -1;
+
+	/* the relcache's attribute numbers are offset for system columns */
+	pkey_attrs = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_PRIMARY_KEY);
+
+	while ((attnum = bms_next_member(pkey_attrs, attnum)) >= 0)
+		keys = bms_add_member(keys, attnum + FirstLowInvalidHeapAttributeNumber);
+
+	bms_free(pkey_attrs);
+#else
+	List      *indexOidList;
+	ListCell  *indexOidScan;
+
+	indexOidList = RelationGetIndexList(rel);
+
+	foreach(indexOidScan, indexOidList)
+	{
+		Oid           indexOid = lfirst_oid(indexOidScan);
+		Form_pg_index indexStruct;
+		HeapTuple     indexTuple;
+		int           i;
+
+		indexTuple = SearchSysCache1(INDEXRELID,
+									 ObjectIdGetDatum(indexOid));
+		if (!HeapTupleIsValid(indexTuple))
+			elog(ERROR, "cache lookup failed for index %u", indexOid);
+		indexStruct = (Form_pg_index) GETSTRUCT(indexTuple);
+
+		if (indexStruct->indisprimary)
+		{
+			for (i = 0; i < indexStruct->indnatts; i++)
+				keys = bms_add_member(keys, indexStruct->indkey.values[i]);
+		}
+
+		ReleaseSysCache(indexTuple);
+	}
+
+	list_free(indexOidList);
+#endif
+
+	if (keys == NULL)
+		elog(ERROR, "table_log_chain: no primary key on table \"%s\" found",
+			 RelationGetRelationName(rel));
+
+	return keys;
+}
+
+/*
+ * Returns true if tuple has been updated or deleted by the
+ * current transaction.
+ */
+static bool isTupleSuperseded(HeapTuple tuple)
+{
+	HeapTupleHeader htup = tuple->t_data;
+
+	if (htup->t_infomask & HEAP_XMAX_INVALID)
+		return false;
+
+	/* only locked, e.g. by SELECT ... FOR UPDATE */
+	if (HEAP_XMAX_IS_LOCKED_ONLY(htup->t_infomask))
+		return false;
+
+	return TransactionIdIsCurrentTransactionId(HeapTupleHeaderGetUpdateXid(htup));
+}
+
+/*
+ * The pending original images go away with TopTransactionContext.
+ */
+static void tableLogCoalesceXactCallback(XactEvent event, void *arg)
+{
+	if (event == XACT_EVENT_COMMIT || event == XACT_EVENT_ABORT
+		|| event == XACT_EVENT_PARALLEL_COMMIT || event == XACT_EVENT_PARALLEL_ABORT
+		|| event == XACT_EVENT_PREPARE)
+	{
+		tableLogCoalescePending = NULL;
+	}
+}
+
+/*
+ * Takes a snapshot of the original table with table_log_snapshot()
+ * before it is truncated. The snapshot contains all log entries
+ * up to the TRUNCATE marker, which is written afterwards.
+ *
+ * TRUNCATE may be granted to users who can't create or register
+ * the snapshot, it is taken as the owner of the original table,
+ * like the RI triggers run their queries as the table owner.
+ *
+ * Without a trigger_id in the log table snapshots can't tell which
+ * log entries they contain, then only the marker is written and
+ * restores have to roll forward over it.
+ */
+static void takeTruncateSnapshot(TableLogDescr *descr,
+								 Oid ext_namespace)
+{
+	TriggerData    *trigdata = DESCR_TRIGDATA(*descr);
+	char           *log_name;
+	Oid             log_nspid;
+	Oid             log_relid = InvalidOid;
+	Oid             save_userid;
+	int             save_sec_context;
+	int             ret;
+	StringInfoData  query;
+
+	/*
+	 * Nothing to do if the extension objects haven't been
+	 * upgraded yet.
+	 */
+	if (get_relname_relid("table_log_snapshots", ext_namespace) == InvalidOid)
+		return;
+
+	/*
+	 * Restores read the whole log table, which is the view over
+	 * all partitions in partition mode, see getActiveLogTable().
+	 */
+	if (trigdata->tg_trigger->tgnargs > 0)
+		log_name = trigdata->tg_trigger->tgargs[0];
+	else
+		log_name = psprintf("%s_log", SPI_getrelname(trigdata->tg_relation));
+
+	log_nspid = get_namespace_oid(descr->ident_log.schema, true);
+
+	if (log_nspid != InvalidOid)
+		log_relid = get_relname_relid(log_name, log_nspid);
+
+	if (log_relid == InvalidOid ||
+		get_attnum(log_relid, "trigger_id") == InvalidAttrNumber)
+	{
+		elog(DEBUG2, "no snapshot for TRUNCATE, log table has no trigger_id");
+		return;
+	}
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT %s.table_log_snapshot(%u::regclass, %u::regclass)",
+					 do_quote_ident(get_namespace_name(ext_namespace)),
+					 RelationGetRelid(trigdata->tg_relation),
+					 log_relid);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(trigdata->tg_relation->rd_rel->relowner,
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	ret = SPI_exec(query.data, 0);
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not take snapshot of relation %s",
+			 SPI_getrelname(trigdata->tg_relation));
+	}
+
+	pfree(query.data);
+}
+
 /*
 __table_log()
 
@@ -716,9 +1929,9 @@ helper function for table_log()
 
 parameter:
   - trigger data
-  - change mode (INSERT, UPDATE, DELETE)
+  - change mode (INSERT, UPDATE, DELETE, TRUNCATE)
   - tuple to log (old, new)
-  - pointer to tuple
+  - pointer to tuple, NULL logs all columns as NULL (TRUNCATE)
   - number columns in table
   - logging table
   - flag for writing session user
@@ -737,6 +1950,12 @@ static void __table_log (TableLogDescr *descr,
 	int        found_col;
 	int        ret;
 
+	if (descr->journal_ident != NULL)
+	{
+		__table_log_journal(descr, changed_mode, changed_tuple, tuple);
+		return;
+	}
+
 	elog(DEBUG2, "build query");
 
 	/* allocate memory */
@@ -804,9 +2023,9 @@ static void __table_log (TableLogDescr *descr,
 		}
 		while (found_col == 0);
 
-		before_char = SPI_getvalue(tuple,
-								   DESCR_TRIGDATA_GET_TUPDESC((*descr)),
-								   col_nr);
+		before_char = (tuple != NULL)
+			? SPI_getvalue(tuple, DESCR_TRIGDATA_GET_TUPDESC((*descr)), col_nr)
+			: NULL;
 
 		if (before_char == NULL)
 		{
@@ -848,47 +2067,111 @@ static void __table_log (TableLogDescr *descr,
 	elog(DEBUG2, "done");
 }
 
-
-#ifdef FUNCAPI_H_not_implemented
 /*
-table_log_show_column()
+__table_log_journal()
 
-show a single column on a date in the past
+helper function for __table_log() in journal mode: writes the change
+into the shared journal, with the original table and the whole row as
+jsonb keyed by column name, which stays readable after the original
+table is altered
 
 parameter:
-  not yet defined
+  - trigger data
+  - change mode (INSERT, UPDATE, DELETE, TRUNCATE)
+  - tuple to log (old, new)
+  - pointer to tuple, NULL logs no row (TRUNCATE)
 return:
-  not yet defined
+  none
 */
-Datum table_log_show_column(PG_FUNCTION_ARGS)
+static void __table_log_journal(TableLogDescr *descr,
+								char          *changed_mode,
+								char          *changed_tuple,
+								HeapTuple      tuple)
 {
-	TriggerData    *trigdata = (TriggerData *) fcinfo->context;
+	StringInfoData query;
+	Oid            argtypes[1];
+	Datum          values[1];
+	char           nulls[1];
+	bool           isnull;
+	Oid            save_userid;
+	int            save_sec_context;
 	int            ret;
 
-	/*
-	 * Some checks first...
-	 */
-	elog(DEBUG2, "start table_log_show_column()");
+	if (tuple != NULL)
+	{
+		/*
+		 * Convert the row as the user changing it: to_jsonb() calls
+		 * the casts to json of the column types, which must not run
+		 * with the privileges of the journal owner.
+		 */
+		argtypes[0] = DESCR_TRIGDATA_GET_RELATION((*descr))->rd_rel->reltype;
+		values[0]   = heap_copy_tuple_as_datum(tuple,
+											   DESCR_TRIGDATA_GET_TUPDESC((*descr)));
+		nulls[0]    = ' ';
 
-	/* Connect to SPI manager */
-	ret = SPI_connect();
-	if (ret != SPI_OK_CONNECT)
+		ret = SPI_execute_with_args("SELECT to_jsonb($1)", 1, argtypes, values, nulls,
+									false, 1);
+
+		if (ret != SPI_OK_SELECT || SPI_processed != 1)
+		{
+			elog(ERROR, "could not convert row for journal %s (error: %d)",
+				 descr->journal_ident,
+				 ret);
+		}
+
+		/* stays valid until SPI_finish() */
+		values[0] = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1, &isnull);
+		nulls[0]  = isnull ? 'n' : ' ';
+	}
+	else
 	{
-		elog(ERROR, "table_log_show_column: SPI_connect returned %d", ret);
+		values[0] = (Datum) 0;
+		nulls[0]  = 'n';
 	}
 
-	elog(DEBUG2, "this function isnt available yet");
+	argtypes[0] = JSONBOID;
 
-	/* close SPI connection */
-	SPI_finish();
-	return PG_RETURN_NULL;
-}
-#endif /* FUNCAPI_H */
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s (trigger_relid, trigger_mode, trigger_tuple, "
+					 "trigger_changed, trigger_user, trigger_row) "
+					 "VALUES (%u::oid, %s, %s, NOW(), %s, $1)",
+					 descr->journal_ident,
+					 RelationGetRelid(DESCR_TRIGDATA_GET_RELATION((*descr))),
+					 do_quote_literal(changed_mode),
+					 do_quote_literal(changed_tuple),
+					 (descr->use_session_user == 1) ? "SESSION_USER" : "NULL");
 
-/*
- * Retrieves the columns of the primary key the original
- * table has and stores their attribute numbers in the
- * specified TableLogRestoreDescr descriptor. The caller is responsible
+	elog(DEBUG3, "query: %s", query.data);
+
+	/*
+	 * Users can only read the journal, so insert as its owner, the
+	 * way the RI triggers check as the owner of a table. Only the
+	 * plain INSERT runs as the owner, the row is already converted.
+	 * An error resets the user at the end of the (sub)transaction.
+	 */
+	GetUserIdAndSecContext(&save_userid, &save_sec_context);
+	SetUserIdAndSecContext(descr->journal_owner,
+						   save_sec_context | SECURITY_LOCAL_USERID_CHANGE);
+
+	ret = SPI_execute_with_args(query.data, 1, argtypes, values, nulls, false, 0);
+
+	SetUserIdAndSecContext(save_userid, save_sec_context);
+	if (ret != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not insert log information into journal %s (error: %d)",
+			 descr->journal_ident,
+			 ret);
+	}
+
+	pfree(query.data);
+}
+
+
+/*
+ * Retrieves the columns of the primary key the original
+ * table has and stores their attribute numbers in the
+ * specified TableLogRestoreDescr descriptor. The caller is responsible
  * to pass a valid descriptor initialized by initTableLogRestoreDescr().
  */
 static void getRelationPrimaryKeyColumns(TableLogRestoreDescr *restore_descr)
@@ -967,6 +2250,87 @@ static void getRelationPrimaryKeyColumns(TableLogRestoreDescr *restore_descr)
 #endif
 }
 
+/*
+ * Returns what is logged into the log table of the restore descriptor,
+ * looking at the row triggers of the original table logging into it:
+ * TABLE_LOG_MODE_BASIC for table_log_basic(), TABLE_LOG_MODE_CHAIN for
+ * table_log_chain(), otherwise TABLE_LOG_MODE_FULL. A log table written
+ * by table_log() as well has all images.
+ */
+static int getLogMode(TableLogRestoreDescr *restore_descr)
+{
+	Relation  origRel;
+	char     *log_relname;
+	Oid       log_nspid;
+	int       log_mode = TABLE_LOG_MODE_FULL;
+	bool      full     = false;
+	int       i;
+
+	log_relname = get_rel_name(restore_descr->log_relid);
+
+	if (log_relname == NULL)
+		return TABLE_LOG_MODE_FULL;
+
+	log_nspid = get_rel_namespace(restore_descr->log_relid);
+
+#if PG_VERSION_NUM >= 120000
+	origRel = table_open(restore_descr->orig_relid, AccessShareLock);
+#else
+	origRel = heap_open(restore_descr->orig_relid, AccessShareLock);
+#endif
+
+	for (i = 0; origRel->trigdesc != NULL && i < origRel->trigdesc->numtriggers; i++)
+	{
+		Trigger *trigger = &origRel->trigdesc->triggers[i];
+		char    *funcname;
+		char    *log_name;
+		Oid      log_schema;
+
+		if (!TRIGGER_FOR_ROW(trigger->tgtype))
+			continue;
+
+		/* same defaults as table_log_prepare() */
+		if (trigger->tgnargs > 0)
+			log_name = trigger->tgargs[0];
+		else
+			log_name = psprintf("%s_log", restore_descr->orig_relname);
+
+		if (trigger->tgnargs > 2)
+			log_schema = get_namespace_oid(trigger->tgargs[2], true);
+		else
+			log_schema = RelationGetNamespace(origRel);
+
+		/* a log table of the same name in another schema isn't ours */
+		if (strcmp(log_name, log_relname) != 0 || log_schema != log_nspid)
+			continue;
+
+		funcname = get_func_name(trigger->tgfoid);
+
+		if (funcname == NULL)
+			continue;
+
+		if (strcmp(funcname, "table_log_basic") == 0)
+			log_mode = TABLE_LOG_MODE_BASIC;
+		else if (strcmp(funcname, "table_log_chain") == 0)
+			log_mode = TABLE_LOG_MODE_CHAIN;
+		else if (strcmp(funcname, "table_log") == 0)
+			full = true;
+	}
+
+#if PG_VERSION_NUM >= 120000
+	table_close(origRel, AccessShareLock);
+#else
+	heap_close(origRel, AccessShareLock);
+#endif
+
+	return full ? TABLE_LOG_MODE_FULL : log_mode;
+}
+
+/*
+ * Initializes the restore descriptor from the arguments of
+ * table_log_restore_table(). table_restore may be NULL if the
+ * caller doesn't restore into a table.
+ */
 static void setTableLogRestoreDescr(TableLogRestoreDescr *restore_descr,
 									char *table_orig,
 									char *table_orig_pkey,
@@ -1007,7 +2371,12 @@ static void setTableLogRestoreDescr(TableLogRestoreDescr *restore_descr,
 	 * be search_path aware!
 	 */
 
-	if (!SplitIdentifierString(table_restore, '.', &restoreIdentList))
+	if (table_restore == NULL)
+	{
+		/* the caller doesn't restore into a table */
+		restoreIdentList = NIL;
+	}
+	else if (!SplitIdentifierString(table_restore, '.', &restoreIdentList))
 	{
 		elog(ERROR, "invalid syntax for restore table name: \"%s\"",
 			 table_restore);
@@ -1080,7 +2449,11 @@ static void setTableLogRestoreDescr(TableLogRestoreDescr *restore_descr,
 	/*
 	 * ... the same for the restore table
 	 */
-	if (restore_descr->use_schema_restore)
+	if (table_restore == NULL)
+	{
+		restore_descr->restore_relid = InvalidOid;
+	}
+	else if (restore_descr->use_schema_restore)
 	{
 		Oid nspOid;
 
@@ -1131,6 +2504,8 @@ static void setTableLogRestoreDescr(TableLogRestoreDescr *restore_descr,
 	 */
 	restore_descr->pkey_log = pstrdup(table_log_pkey);
 
+	restore_descr->log_mode = getLogMode(restore_descr);
+
 	/*
 	 * Map the attribute number for the pk to its
 	 * column names.
@@ -1187,6 +2562,40 @@ static void mapPrimaryKeyColumnNames(TableLogRestoreDescr *restore_descr)
 	}
 }
 
+/*
+ * Initializes the restore descriptor for the functions taking the
+ * original and the log table as regclass. Only the original and the
+ * log table and the primary key of the original table are set.
+ */
+static void setTableLogRestoreDescrByOid(TableLogRestoreDescr *restore_descr,
+										 Oid orig_relid,
+										 Oid log_relid)
+{
+	memset(restore_descr, 0, sizeof(TableLogRestoreDescr));
+	restore_descr->orig_relid   = orig_relid;
+	restore_descr->orig_relname = get_rel_name(orig_relid);
+	restore_descr->log_relid    = log_relid;
+
+	if (restore_descr->orig_relname == NULL)
+	{
+		elog(ERROR, "lookup for relation %u failed", orig_relid);
+	}
+	if (get_rel_name(log_relid) == NULL)
+	{
+		elog(ERROR, "lookup for relation %u failed", log_relid);
+	}
+
+	getRelationPrimaryKeyColumns(restore_descr);
+
+	if (restore_descr->orig_num_pk_attnums <= 0)
+		elog(ERROR, "no primary key on table \"%s\" found",
+			 restore_descr->orig_relname);
+
+	mapPrimaryKeyColumnNames(restore_descr);
+
+	restore_descr->log_mode = getLogMode(restore_descr);
+}
+
 static inline char *
 StringListToString(List *list, int length, StringInfo buf)
 {
@@ -1228,651 +2637,4984 @@ AttrNumberArrayToString(int *attrnums, int length, StringInfo buf)
 }
 
 /*
-  table_log_restore_table()
-
-  restore a complete table based on the logging table
-
-  parameter:
-  - original table name
-  - name of primary key in original table
-  - logging table
-  - name of primary key in logging table
-  - restore table name
-  - timestamp for restoring data
-  - primary key to restore (only this key will be restored) (optional)
-  - restore mode
-    0: restore from blank table (default)
-       needs a complete logging table
-    1: restore from actual table backwards
-  - dont create table temporarly
-    0: create restore table temporarly (default)
-    1: create restore table not temporarly
-  return:
-    not yet defined
-*/
-Datum table_log_restore_table(PG_FUNCTION_ARGS)
+ * Appends the comma separated, quoted list of the primary key columns
+ * (or any other list of column names) to buf. If qualifier is not NULL,
+ * each column is qualified with it.
+ */
+static void appendKeyColumnList(StringInfo buf,
+								List *pk_attr_names,
+								const char *qualifier)
 {
-	TableLogRestoreDescr restore_descr;
-
-	/* the primary key in the original table */
-	char  *table_orig_pkey;
+	ListCell *scan;
+	bool      first = true;
 
-	/* number columns in log table */
-	int  table_log_columns = 0;
+	foreach(scan, pk_attr_names)
+	{
+		if (!first)
+			appendStringInfoString(buf, ", ");
 
-	/* the timestamp in past */
-	Datum      timestamp = PG_GETARG_DATUM(5);
+		if (qualifier != NULL)
+			appendStringInfo(buf, "%s.", qualifier);
 
-	/* the single pkey, can be null (then all keys will be restored) */
-	char  *search_pkey = "";
+		appendStringInfoString(buf, do_quote_ident((char *) lfirst(scan)));
+		first = false;
+	}
+}
 
-	/* the restore method
-	   - 0: restore from blank table (default)
-	   needs a complete log table!
-	   - 1: restore from actual table backwards
-	*/
-	int            method = 0;
-	/* dont create restore table temporarly
-	   - 0: create restore table temporarly (default)
-	   - 1: dont create restore table temporarly
-	*/
-	int            not_temporarly = 0;
-	int            ret, results, i, number_columns;
+/*
+ * Appends the condition selecting the log entries which must be
+ * applied to the base of the restore described by state. If qualifier
+ * is not NULL, the log columns are qualified with it.
+ */
+static void appendLogWindow(StringInfo buf,
+							TableLogStateQuery *state,
+							const char *qualifier)
+{
+	const char *prefix = (qualifier != NULL) ? "." : "";
 
-    /*
-	 * for getting table infos
-	 */
-	StringInfo     query;
+	appendStringInfo(buf, "%s%strigger_changed %s %s",
+					 (qualifier != NULL) ? qualifier : "",
+					 prefix,
+					 (state->method == 1) ? ">" : "<=",
+					 state->timestamp);
 
-	int            need_search_pkey = 0;          /* does we have a single key to restore? */
-	char           *tmp, *timestamp_string, *old_pkey_string = "";
-	char           *trigger_mode;
-	char           *trigger_tuple;
-	char           *trigger_changed;
-	SPITupleTable  *spi_tuptable = NULL;          /* for saving query results */
+	if (state->log_window != NULL)
+	{
+		appendStringInfo(buf, " AND %s%s%s %s",
+						 (qualifier != NULL) ? qualifier : "",
+						 prefix,
+						 state->log_pkey,
+						 state->log_window);
+	}
+}
 
-	/* memory for dynamic query */
-	StringInfo      d_query;
+/*
+ * Appends the predicate identifying TRUNCATE markers to buf. All
+ * columns of the original table are NULL in a marker, testing the
+ * first key column lets the planner use the key index of the log.
+ */
+static void appendTruncateMarker(StringInfo buf,
+								 List *pk_attr_names,
+								 const char *qualifier)
+{
+	const char *prefix = (qualifier != NULL) ? "." : "";
+
+	appendStringInfo(buf, "%s%s%s IS NULL AND %s%strigger_mode = 'TRUNCATE'",
+					 (qualifier != NULL) ? qualifier : "",
+					 prefix,
+					 do_quote_ident((char *) linitial(pk_attr_names)),
+					 (qualifier != NULL) ? qualifier : "",
+					 prefix);
+}
 
-	/* memory for column names */
-	StringInfo      col_query;
+/*
+ * Returns true if the log entries of log_ident selected by
+ * condition contain a TRUNCATE marker. The caller must be
+ * connected to SPI.
+ */
+static bool logHasTruncate(const char *log_ident,
+						   List *pk_attr_names,
+						   const char *condition)
+{
+	StringInfoData query;
+	bool           found;
 
-	int      col_pkey = 0;
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT 1 FROM %s WHERE ", log_ident);
+	appendTruncateMarker(&query, pk_attr_names, NULL);
+	appendStringInfo(&query, " AND %s LIMIT 1", condition);
 
-	/*
-	 * Some checks first...
-	 */
-	elog(DEBUG2, "start table_log_restore_table()");
+	elog(DEBUG3, "query: %s", query.data);
 
-  /* does we have all arguments? */
-	if (PG_ARGISNULL(0))
+	if (SPI_exec(query.data, 0) != SPI_OK_SELECT)
 	{
-		elog(ERROR, "table_log_restore_table: missing original table name");
+		elog(ERROR, "could not check log table %s for TRUNCATE", log_ident);
 	}
-	if (PG_ARGISNULL(1))
+
+	found = (SPI_processed > 0);
+
+	pfree(query.data);
+
+	return found;
+}
+
+/*
+ * Appends a query to buf which returns the rows of the logged
+ * table as they were at the timestamp described by state.
+ *
+ * Instead of replaying every log entry, the state of each key is
+ * derived from a single log entry: rolling forward, the last
+ * entry up to the timestamp decides (a "new" tuple means the key
+ * exists with that image, an "old" tuple means it was deleted or
+ * renamed). Rolling backward, the first entry after the timestamp
+ * decides (an "old" tuple is the image at the timestamp, a "new"
+ * tuple means the key didn't exist yet). All keys of the base
+ * relation without log entries to apply are taken as they are.
+ *
+ * A filter is checked against the image a key ends up with. Only
+ * keys with a log entry matching the filter are looked at, since the
+ * deciding entry of a matching key matches itself.
+ *
+ * Rolling forward over a TRUNCATE marker, the base and all log
+ * entries up to the last marker are void. Rolling backward over a
+ * marker is impossible, getRestoreCandidates() never starts there.
+ * A chain log is rolled backward by appendChainStateQuery().
+ *
+ * Since keys are independent of each other, the planner is free to
+ * execute this query with parallel workers.
+ */
+static void appendRestoreStateQuery(StringInfo buf,
+									TableLogStateQuery *state)
+{
+	if (state->base_ident != NULL)
 	{
-		table_orig_pkey = NULL;
+		/* keys of the base not touched by the log entries to apply */
+		appendStringInfo(buf,
+						 "SELECT %s FROM %s AS table_log_base "
+						 "WHERE NOT EXISTS (SELECT 1 FROM %s AS table_log_newer WHERE ",
+						 state->col_list,
+						 state->base_ident,
+						 state->log_ident);
+		appendLogWindow(buf, state, "table_log_newer");
+		appendStringInfoString(buf, " AND (");
+		appendKeyColumnList(buf, state->pk_attr_names, "table_log_newer");
+		appendStringInfoString(buf, ") = (");
+		appendKeyColumnList(buf, state->pk_attr_names, "table_log_base");
+		appendStringInfoString(buf, ")) ");
+
+		if (state->method == 0)
+		{
+			appendStringInfo(buf,
+							 "AND NOT EXISTS (SELECT 1 FROM %s AS table_log_truncate WHERE ",
+							 state->log_ident);
+			appendLogWindow(buf, state, "table_log_truncate");
+			appendStringInfoString(buf, " AND ");
+			appendTruncateMarker(buf, state->pk_attr_names, "table_log_truncate");
+			appendStringInfoString(buf, ") ");
+		}
+
+		if (state->search_pkey_values != NULL || state->search_keys != NULL ||
+			state->filter != NULL)
+		{
+			appendRestoreFilter(buf, state, "AND");
+			appendStringInfoChar(buf, ' ');
+		}
+
+		appendStringInfoString(buf, "UNION ALL ");
 	}
-	if (PG_ARGISNULL(2))
+
+	if (state->method == 1 && state->log_mode == TABLE_LOG_MODE_CHAIN)
 	{
-		elog(ERROR, "table_log_restore_table: missing log table name");
+		appendChainStateQuery(buf, state);
+		return;
 	}
-	if (PG_ARGISNULL(3))
+
+	/* the deciding log entry of each key */
+	appendStringInfo(buf,
+					 "SELECT %s FROM (SELECT DISTINCT ON (",
+					 state->col_list);
+	appendKeyColumnList(buf, state->pk_attr_names, NULL);
+	appendStringInfo(buf,
+					 ") %s, trigger_tuple FROM %s WHERE ",
+					 state->col_list,
+					 state->log_ident);
+	appendLogWindow(buf, state, NULL);
+	appendStringInfoChar(buf, ' ');
+
+	if (state->method == 0)
 	{
-		elog(ERROR, "table_log_restore_table: missing primary key name for log table");
+		/* NULL if there is no marker */
+		appendStringInfo(buf,
+						 "AND (%s > (SELECT max(table_log_truncate.%s) FROM %s AS table_log_truncate WHERE ",
+						 state->log_pkey,
+						 state->log_pkey,
+						 state->log_ident);
+		appendLogWindow(buf, state, "table_log_truncate");
+		appendStringInfoString(buf, " AND ");
+		appendTruncateMarker(buf, state->pk_attr_names, "table_log_truncate");
+		appendStringInfoString(buf, ")) IS NOT FALSE ");
 	}
-	if (PG_ARGISNULL(4))
+
+	if (state->search_pkey_values != NULL || state->search_keys != NULL)
 	{
-		elog(ERROR, "table_log_restore_table: missing copy table name");
+		appendSearchKeyFilter(buf, state, "AND");
+		appendStringInfoChar(buf, ' ');
 	}
-	if (PG_ARGISNULL(5))
+
+	if (state->filter != NULL)
 	{
-		elog(ERROR, "table_log_restore_table: missing timestamp");
+		appendStringInfoString(buf, "AND (");
+		appendKeyColumnList(buf, state->pk_attr_names, NULL);
+		appendStringInfoString(buf, ") IN (SELECT ");
+		appendKeyColumnList(buf, state->pk_attr_names, "table_log_match");
+		appendStringInfo(buf, " FROM %s AS table_log_match WHERE ",
+						 state->log_ident);
+		appendLogWindow(buf, state, "table_log_match");
+		appendStringInfo(buf, " AND (%s)) ", state->filter);
 	}
 
-	/* first check number arguments to avoid an segfault */
-	if (PG_NARGS() >= 7)
-	{
-		/* if argument is given, check if not null */
-		if (!PG_ARGISNULL(6))
-		{
-			/* yes, fetch it */
-			search_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(6));
+	appendStringInfoString(buf, "ORDER BY ");
+	appendKeyColumnList(buf, state->pk_attr_names, NULL);
+	appendStringInfo(buf,
+					 ", %s %s) AS table_log_state WHERE trigger_tuple = %s",
+					 state->log_pkey,
+					 (state->method == 1) ? "ASC" : "DESC",
+					 (state->method == 1) ? "'old'" : "'new'");
 
-			/* and check, if we have an argument */
-			if (strlen(search_pkey) > 0)
-			{
-				need_search_pkey = 1;
-				elog(DEBUG2, "table_log_restore_table: will restore a single key");
-			}
-		}
-	} /* nargs >= 7 */
+	if (state->filter != NULL)
+		appendStringInfo(buf, " AND (%s)", state->filter);
+}
 
-	/* same procedere here */
-	if (PG_NARGS() >= 8)
+/*
+ * Appends the log part of the state query for rolling a chain log
+ * backward, see appendRestoreStateQuery(). A chain log has no old
+ * images, so the image of each key changed after the timestamp is
+ * the last entry of the key up to the timestamp (after the last
+ * TRUNCATE marker), as when rolling forward. A key without such an
+ * entry didn't exist, checkLogChain() makes sure it was inserted.
+ */
+static void appendChainStateQuery(StringInfo buf,
+								  TableLogStateQuery *state)
+{
+	appendStringInfo(buf,
+					 "SELECT %s FROM (SELECT DISTINCT ON (",
+					 state->col_list);
+	appendKeyColumnList(buf, state->pk_attr_names, NULL);
+	appendStringInfo(buf,
+					 ") %s, trigger_tuple FROM %s WHERE trigger_changed <= %s ",
+					 state->col_list,
+					 state->log_ident,
+					 state->timestamp);
+
+	/* NULL if there is no marker */
+	appendStringInfo(buf,
+					 "AND (%s > (SELECT max(table_log_truncate.%s) FROM %s AS table_log_truncate "
+					 "WHERE table_log_truncate.trigger_changed <= %s AND ",
+					 state->log_pkey,
+					 state->log_pkey,
+					 state->log_ident,
+					 state->timestamp);
+	appendTruncateMarker(buf, state->pk_attr_names, "table_log_truncate");
+	appendStringInfoString(buf, ")) IS NOT FALSE AND (");
+
+	/* the keys changed by the log entries to roll back */
+	appendKeyColumnList(buf, state->pk_attr_names, NULL);
+	appendStringInfoString(buf, ") IN (SELECT ");
+	appendKeyColumnList(buf, state->pk_attr_names, "table_log_newer");
+	appendStringInfo(buf, " FROM %s AS table_log_newer WHERE ",
+					 state->log_ident);
+	appendLogWindow(buf, state, "table_log_newer");
+	appendStringInfoString(buf, ") ");
+
+	if (state->search_pkey_values != NULL || state->search_keys != NULL)
 	{
-		if (!PG_ARGISNULL(7))
-		{
-			method = PG_GETARG_INT32(7);
+		appendSearchKeyFilter(buf, state, "AND");
+		appendStringInfoChar(buf, ' ');
+	}
 
-			if (method > 0)
-			{
-				method = 1;
-			}
-			else
-			{
-				method = 0;
-			}
-		}
-	} /* nargs >= 8 */
+	appendStringInfoString(buf, "ORDER BY ");
+	appendKeyColumnList(buf, state->pk_attr_names, NULL);
+	appendStringInfo(buf,
+					 ", %s DESC) AS table_log_state WHERE trigger_tuple = 'new'",
+					 state->log_pkey);
 
-	if (method == 1)
-		elog(DEBUG2, "table_log_restore_table: will restore from actual state backwards");
-	else
-		elog(DEBUG2, "table_log_restore_table: will restore from begin forward");
+	if (state->filter != NULL)
+		appendStringInfo(buf, " AND (%s)", state->filter);
+}
 
-	if (PG_NARGS() >= 9)
+/*
+ * Rolling a chain log backward takes the image of a key from its
+ * entry before the ones rolled back. Rows which existed before the
+ * log was started have no such entry, the restore described by state
+ * errors out if it would need one. The caller must be connected to SPI.
+ */
+static void checkLogChain(TableLogStateQuery *state)
+{
+	StringInfoData query;
+
+	if (state->method != 1 || state->log_mode != TABLE_LOG_MODE_CHAIN)
+		return;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT 1 FROM %s AS table_log_newer WHERE ",
+					 state->log_ident);
+	appendLogWindow(&query, state, "table_log_newer");
+	appendStringInfo(&query,
+					 " AND table_log_newer.trigger_mode IN ('UPDATE', 'DELETE') "
+					 "AND NOT EXISTS (SELECT 1 FROM %s AS table_log_older WHERE (",
+					 state->log_ident);
+	appendKeyColumnList(&query, state->pk_attr_names, "table_log_older");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, state->pk_attr_names, "table_log_newer");
+	appendStringInfo(&query,
+					 ") AND table_log_older.%s < table_log_newer.%s)",
+					 state->log_pkey,
+					 state->log_pkey);
+	appendSearchKeyFilter(&query, state, "AND");
+	appendStringInfoString(&query, " LIMIT 1");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_SELECT)
 	{
-		if (!PG_ARGISNULL(8))
-		{
-			not_temporarly = PG_GETARG_INT32(8);
+		elog(ERROR, "could not check log table %s", state->log_ident);
+	}
 
-			if (not_temporarly > 0)
-			{
-				not_temporarly = 1;
-				elog(DEBUG2, "table_log_restore_table: dont create restore table temporarly");
-			}
-			else
-			{
-				not_temporarly = 0;
-			}
-		}
- 	} /* nargs >= 9 */
+	if (SPI_processed > 0)
+	{
+		elog(ERROR, "log table %s has no earlier image of a row changed after the timestamp, "
+			 "rows existing before the log was started can't be restored backward",
+			 state->log_ident);
+	}
 
-	/* get parameter and set them to the restore descriptor */
+	pfree(query.data);
+}
 
-	setTableLogRestoreDescr(&restore_descr,
+/*
+ * Looks for the snapshot of the original table taken by
+ * table_log_snapshot() which is closest to the timestamp of the
+ * restore described by state. If this snapshot is closer to the
+ * timestamp than the starting point of the requested restore method
+ * (the first log entry when rolling forward or the current time when
+ * rolling backward), state is changed to start from the snapshot and
+ * to replay only the log entries between the snapshot and the timestamp,
+ * in whichever direction is required.
+ *
+ * ext_namespace is the namespace the table_log extension lives in. The
+ * caller must be connected to SPI.
+ */
+static void getRestoreSnapshot(TableLogRestoreDescr *restore_descr,
+							   TableLogStateQuery *state,
+							   Oid ext_namespace)
+{
+	StringInfoData query;
+	int            ret;
+	bool           isnull;
+	bool           forward;
+	Oid            snapshot_relid;
+	int64          snapshot_trigger_id;
+	float8         distance;
+	float8         base_distance;
+
+	/*
+	 * Nothing to do if the extension objects haven't been
+	 * upgraded yet.
+	 */
+	if (get_relname_relid("table_log_snapshots", ext_namespace) == InvalidOid)
+		return;
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT s.snapshot_rel::oid, s.trigger_id, "
+					 "s.trigger_changed <= %s::timestamptz, "
+					 "abs(extract(epoch FROM s.trigger_changed - %s::timestamptz))::float8, "
+					 "extract(epoch FROM clock_timestamp() - %s::timestamptz)::float8, "
+					 "COALESCE(extract(epoch FROM %s::timestamptz - "
+					 "(SELECT trigger_changed FROM %s ORDER BY %s LIMIT 1)), 0)::float8 "
+					 "FROM %s.table_log_snapshots s "
+					 "WHERE s.orig_rel::oid = %u AND s.log_rel::oid = %u "
+					 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = s.snapshot_rel::oid) "
+					 "ORDER BY 4 LIMIT 1",
+					 state->timestamp,
+					 state->timestamp,
+					 state->timestamp,
+					 state->timestamp,
+					 state->log_ident,
+					 state->log_pkey,
+					 do_quote_ident(get_namespace_name(ext_namespace)),
+					 restore_descr->orig_relid,
+					 restore_descr->log_relid);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	ret = SPI_exec(query.data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not get snapshots of relation \"%s\"",
+			 restore_descr->orig_relname);
+	}
+
+	if (SPI_processed == 0)
+	{
+		elog(DEBUG2, "no snapshot of relation \"%s\" found",
+			 restore_descr->orig_relname);
+		pfree(query.data);
+		return;
+	}
+
+	snapshot_relid = DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+													SPI_tuptable->tupdesc,
+													1, &isnull));
+	snapshot_trigger_id = DatumGetInt64(SPI_getbinval(SPI_tuptable->vals[0],
+													  SPI_tuptable->tupdesc,
+													  2, &isnull));
+	forward        = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+												SPI_tuptable->tupdesc,
+												3, &isnull));
+	distance       = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0],
+												  SPI_tuptable->tupdesc,
+												  4, &isnull));
+
+	/* distance of the starting point of the requested method */
+	base_distance  = DatumGetFloat8(SPI_getbinval(SPI_tuptable->vals[0],
+												  SPI_tuptable->tupdesc,
+												  (state->method == 1) ? 5 : 6,
+												  &isnull));
+
+	if (base_distance <= distance)
+	{
+		elog(DEBUG2, "snapshot %u is not closer than the restore start",
+			 snapshot_relid);
+		pfree(query.data);
+		return;
+	}
+
+	if (forward && restore_descr->log_mode == TABLE_LOG_MODE_BASIC)
+	{
+		elog(DEBUG2, "snapshot %u would need rolling forward a basic log",
+			 snapshot_relid);
+		pfree(query.data);
+		return;
+	}
+
+	elog(DEBUG2, "restore %s from snapshot %u (trigger_id " INT64_FORMAT ")",
+		 forward ? "forward" : "backward",
+		 snapshot_relid,
+		 snapshot_trigger_id);
+
+	state->base_ident = quote_qualified_identifier(get_namespace_name(get_rel_namespace(snapshot_relid)),
+												   get_rel_name(snapshot_relid));
+	state->method     = forward ? 0 : 1;
+
+	resetStringInfo(&query);
+	appendStringInfo(&query, "%s " INT64_FORMAT,
+					 forward ? ">" : "<=",
+					 snapshot_trigger_id);
+	state->log_window = query.data;
+}
+
+/*
+ * Refuses to register or refresh a restore table in a transaction
+ * using a single snapshot: it was taken before waiting for the lock
+ * on the original table, so entries committed meanwhile would be
+ * below the watermark but missing from the restore table.
+ */
+static void checkRefreshIsolation(const char *caller)
+{
+	if (IsolationUsesXactSnapshot())
+	{
+		elog(ERROR, "%s: restore tables can only be registered and refreshed "
+			 "in READ COMMITTED transactions", caller);
+	}
+}
+
+/*
+ * Registers the restore table created by table_log_restore_table()
+ * in table_log_restores, together with the timestamp it was restored
+ * to and the highest log entry at that time, so it can be moved along
+ * the log later by table_log_refresh_restore(). Entries of dropped
+ * restore tables are removed.
+ *
+ * Log entry ids aren't assigned in commit order, so the caller must
+ * hold a ShareLock on the original table since before the restore,
+ * taken before the first snapshot, see checkRefreshIsolation():
+ * otherwise a transaction could commit an entry below the watermark
+ * afterwards, which would never be applied.
+ *
+ * ext_namespace is the namespace the table_log extension lives in. The
+ * caller must be connected to SPI.
+ */
+static void registerRestoreTable(TableLogRestoreDescr *restore_descr,
+								 TableLogStateQuery *state,
+								 Oid ext_namespace)
+{
+	StringInfoData query;
+	char          *ext_schema;
+
+	/*
+	 * Nothing to do if the extension objects haven't been
+	 * upgraded yet.
+	 */
+	if (get_relname_relid("table_log_restores", ext_namespace) == InvalidOid)
+		return;
+
+	ext_schema = do_quote_ident(get_namespace_name(ext_namespace));
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "DELETE FROM %s.table_log_restores r "
+					 "WHERE NOT EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = r.restore_rel::oid)",
+					 ext_schema);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not clean up table_log_restores");
+	}
+
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "INSERT INTO %s.table_log_restores "
+					 "(restore_rel, orig_rel, log_rel, log_pkey, restored_to, trigger_id) "
+					 "SELECT %s::regclass, %u::oid, %u::oid, %s, %s, COALESCE(max(%s), 0)::bigint FROM %s",
+					 ext_schema,
+					 do_quote_literal((char *) RESTORE_TABLE_IDENT((*restore_descr), restore)),
+					 restore_descr->orig_relid,
+					 restore_descr->log_relid,
+					 do_quote_literal(restore_descr->pkey_log),
+					 state->timestamp,
+					 state->log_pkey,
+					 state->log_ident);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not register restore table: %s",
+			 RESTORE_TABLE_IDENT((*restore_descr), restore));
+	}
+
+	pfree(query.data);
+}
+
+/*
+ * Allows the planner to use the specified number of parallel
+ * workers for the following queries. Returns the GUC nest level
+ * the caller must pass to AtEOXact_GUC() to restore the previous
+ * setting.
+ */
+static int setRestoreParallelWorkers(int workers)
+{
+	int  save_nestlevel = NewGUCNestLevel();
+#if PG_VERSION_NUM >= 90600
+	char value[16];
+
+	snprintf(value, sizeof(value), "%d", workers);
+	(void) set_config_option("max_parallel_workers_per_gather", value,
+							 PGC_USERSET, PGC_S_SESSION,
+							 GUC_ACTION_SAVE, true, 0, false);
+#endif
+
+	return save_nestlevel;
+}
+
+/*
+ * Returns the number of rows the planner expects to be returned
+ * by the specified query. The caller must be connected to SPI.
+ */
+static float8 estimateQueryRows(const char *query)
+{
+	SPIPlanPtr    plan;
+	CachedPlan   *cplan;
+	PlannedStmt  *stmt;
+	float8        rows;
+
+	elog(DEBUG3, "query: %s", query);
+
+	plan = SPI_prepare(query, 0, NULL);
+
+	if (plan == NULL)
+	{
+		elog(ERROR, "could not estimate query: %s", query);
+	}
+
+	/* the estimate of the top plan node */
+	cplan = SPI_plan_get_cached_plan(plan);
+
+	if (cplan == NULL || list_length(cplan->stmt_list) != 1)
+	{
+		elog(ERROR, "could not estimate query: %s", query);
+	}
+
+	stmt = (PlannedStmt *) linitial(cplan->stmt_list);
+
+	if (!IsA(stmt, PlannedStmt) || stmt->planTree == NULL)
+	{
+		elog(ERROR, "could not estimate query: %s", query);
+	}
+
+	rows = stmt->planTree->plan_rows;
+
+#if PG_VERSION_NUM >= 140000
+	ReleaseCachedPlan(cplan, CurrentResourceOwner);
+#else
+	ReleaseCachedPlan(cplan, true);
+#endif
+	SPI_freeplan(plan);
+
+	return rows;
+}
+
+/*
+ * Appends the predicate on the keys to restore to buf, starting
+ * with the given keyword. Does nothing if all keys are restored.
+ */
+static void appendSearchKeyFilter(StringInfo buf,
+								  TableLogStateQuery *state,
+								  const char *keyword)
+{
+	if (state->search_keys != NULL)
+	{
+		/*
+		 * Leave it to the planner to probe the key index for
+		 * each key or to hash the keys, whichever is cheaper.
+		 */
+		appendStringInfo(buf, " %s (", keyword);
+		appendKeyColumnList(buf, state->pk_attr_names, NULL);
+		appendStringInfo(buf, ") IN (%s)", state->search_keys);
+		return;
+	}
+
+	if (state->search_pkey_values == NULL)
+		return;
+
+	appendStringInfo(buf, " %s ", keyword);
+	appendPrimaryKeyPredicate(buf,
+							  state->pk_attr_names,
+							  state->search_pkey_values);
+}
+
+/*
+ * Like appendSearchKeyFilter(), but also appends the filter on the
+ * rows to restore. Does nothing if all rows are restored.
+ */
+static void appendRestoreFilter(StringInfo buf,
+								TableLogStateQuery *state,
+								const char *keyword)
+{
+	appendSearchKeyFilter(buf, state, keyword);
+
+	if (state->filter == NULL)
+		return;
+
+	appendStringInfo(buf, " %s (%s)",
+					 (state->search_pkey_values != NULL || state->search_keys != NULL)
+					 ? "AND" : keyword,
+					 state->filter);
+}
+
+/*
+ * Builds the list of possible starting points for the restore
+ * described by state: rolling forward from an empty table, rolling
+ * backward from the original table, and rolling in either direction
+ * from each snapshot taken by table_log_snapshot().
+ *
+ * For each candidate, the planner estimates the number of rows to copy
+ * from the starting relation and the number of log entries between the
+ * starting point and the timestamp. Thus the estimates are as good as
+ * the statistics of the original and the log table. Rolling backward
+ * over a TRUNCATE marker is impossible, such candidates are left out;
+ * the snapshot taken by the TRUNCATE is a candidate instead. A filter on the
+ * rows is applied to the log entries as well, which is exact for the
+ * base and close enough for the log. The sum of both
+ * is the cost of the candidate, the cheapest one is returned in
+ * *cheapest. On ties, the earlier candidate wins.
+ *
+ * ext_namespace is the namespace the table_log extension lives in. The
+ * caller must be connected to SPI.
+ */
+static List *getRestoreCandidates(TableLogRestoreDescr *restore_descr,
+								  TableLogStateQuery *state,
+								  Oid ext_namespace,
+								  TableLogRestoreCandidate **cheapest)
+{
+	List                     *candidates = NIL;
+	ListCell                 *scan;
+	TableLogRestoreCandidate *candidate;
+	StringInfoData            query;
+
+	initStringInfo(&query);
+
+	/*
+	 * Roll forward from an empty table, unless the log lacks
+	 * the new values of updates...
+	 */
+	if (restore_descr->log_mode != TABLE_LOG_MODE_BASIC)
+	{
+		candidate = (TableLogRestoreCandidate *) palloc0(sizeof(TableLogRestoreCandidate));
+		candidate->method = 0;
+
+		appendStringInfo(&query, "SELECT 1 FROM %s WHERE trigger_changed <= %s",
+						 state->log_ident,
+						 state->timestamp);
+		appendRestoreFilter(&query, state, "AND");
+		candidate->log_rows = estimateQueryRows(query.data);
+
+		candidates = lappend(candidates, candidate);
+	}
+
+	/*
+	 * ...or backward from the original table.
+	 */
+	resetStringInfo(&query);
+	appendStringInfo(&query, "trigger_changed > %s", state->timestamp);
+
+	if (!logHasTruncate(state->log_ident, state->pk_attr_names, query.data))
+	{
+		candidate = (TableLogRestoreCandidate *) palloc0(sizeof(TableLogRestoreCandidate));
+		candidate->base_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+																	ObjectIdGetDatum(restore_descr->orig_relid)));
+		candidate->method     = 1;
+
+		resetStringInfo(&query);
+		appendStringInfo(&query, "SELECT 1 FROM %s", candidate->base_ident);
+		appendRestoreFilter(&query, state, "WHERE");
+		candidate->base_rows = estimateQueryRows(query.data);
+
+		resetStringInfo(&query);
+		appendStringInfo(&query, "SELECT 1 FROM %s WHERE trigger_changed > %s",
+						 state->log_ident,
+						 state->timestamp);
+		appendRestoreFilter(&query, state, "AND");
+		candidate->log_rows = estimateQueryRows(query.data);
+
+		candidates = lappend(candidates, candidate);
+	}
+
+	/*
+	 * Snapshots are only available if the extension objects
+	 * have been upgraded.
+	 */
+	if (get_relname_relid("table_log_snapshots", ext_namespace) != InvalidOid)
+	{
+		SPITupleTable *snapshots;
+		uint64         num_snapshots;
+		uint64         i;
+
+		resetStringInfo(&query);
+		appendStringInfo(&query,
+						 "SELECT s.snapshot_rel::oid, s.trigger_id, "
+						 "s.trigger_changed <= %s::timestamptz, "
+						 "quote_literal(s.trigger_changed) "
+						 "FROM %s.table_log_snapshots s "
+						 "WHERE s.orig_rel::oid = %u AND s.log_rel::oid = %u "
+						 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = s.snapshot_rel::oid) "
+						 "ORDER BY s.snapshot_id",
+						 state->timestamp,
+						 do_quote_ident(get_namespace_name(ext_namespace)),
+						 restore_descr->orig_relid,
+						 restore_descr->log_relid);
+
+		elog(DEBUG3, "query: %s", query.data);
+
+		if (SPI_exec(query.data, 0) != SPI_OK_SELECT)
+		{
+			elog(ERROR, "could not get snapshots of relation \"%s\"",
+				 restore_descr->orig_relname);
+		}
+
+		/* the estimates below overwrite SPI_tuptable */
+		snapshots     = SPI_tuptable;
+		num_snapshots = SPI_processed;
+
+		for (i = 0; i < num_snapshots; i++)
+		{
+			bool   isnull;
+			Oid    snapshot_relid;
+			char  *snapshot_trigger_id;
+			char  *snapshot_changed;
+
+			snapshot_relid      = DatumGetObjectId(SPI_getbinval(snapshots->vals[i],
+																 snapshots->tupdesc,
+																 1, &isnull));
+			snapshot_trigger_id = SPI_getvalue(snapshots->vals[i], snapshots->tupdesc, 2);
+			snapshot_changed    = SPI_getvalue(snapshots->vals[i], snapshots->tupdesc, 4);
+
+			if (DatumGetBool(SPI_getbinval(snapshots->vals[i], snapshots->tupdesc,
+										   3, &isnull)))
+			{
+				if (restore_descr->log_mode == TABLE_LOG_MODE_BASIC)
+					continue;
+			}
+			else
+			{
+				resetStringInfo(&query);
+				appendStringInfo(&query, "trigger_changed > %s AND %s <= %s",
+								 state->timestamp,
+								 state->log_pkey,
+								 snapshot_trigger_id);
+
+				if (logHasTruncate(state->log_ident, state->pk_attr_names, query.data))
+					continue;
+			}
+
+			candidate = (TableLogRestoreCandidate *) palloc0(sizeof(TableLogRestoreCandidate));
+			candidate->base_ident = quote_qualified_identifier(get_namespace_name(get_rel_namespace(snapshot_relid)),
+															   get_rel_name(snapshot_relid));
+			candidate->method     = DatumGetBool(SPI_getbinval(snapshots->vals[i],
+															   snapshots->tupdesc,
+															   3, &isnull)) ? 0 : 1;
+			candidate->log_window = psprintf("%s %s",
+											 (candidate->method == 0) ? ">" : "<=",
+											 snapshot_trigger_id);
+
+			resetStringInfo(&query);
+			appendStringInfo(&query, "SELECT 1 FROM %s", candidate->base_ident);
+			appendRestoreFilter(&query, state, "WHERE");
+			candidate->base_rows = estimateQueryRows(query.data);
+
+			/*
+			 * The planner estimates a time range far better than
+			 * the combination with the log pkey used for the restore.
+			 */
+			resetStringInfo(&query);
+			appendStringInfo(&query,
+							 "SELECT 1 FROM %s WHERE trigger_changed > %s AND trigger_changed <= %s",
+							 state->log_ident,
+							 (candidate->method == 0) ? snapshot_changed : state->timestamp,
+							 (candidate->method == 0) ? state->timestamp : snapshot_changed);
+			appendRestoreFilter(&query, state, "AND");
+			candidate->log_rows = estimateQueryRows(query.data);
+
+			candidates = lappend(candidates, candidate);
+		}
+	}
+
+	*cheapest = NULL;
+
+	foreach(scan, candidates)
+	{
+		candidate = (TableLogRestoreCandidate *) lfirst(scan);
+
+		elog(DEBUG2, "restore candidate %s (%s): %.0f base rows, %.0f log rows",
+			 (candidate->base_ident != NULL) ? candidate->base_ident : "empty table",
+			 (candidate->method == 1) ? "backward" : "forward",
+			 candidate->base_rows,
+			 candidate->log_rows);
+
+		if (*cheapest == NULL
+			|| (candidate->base_rows + candidate->log_rows
+				< (*cheapest)->base_rows + (*cheapest)->log_rows))
+		{
+			*cheapest = candidate;
+		}
+	}
+
+	if (*cheapest == NULL)
+	{
+		elog(ERROR, "no starting point to restore relation \"%s\" from, "
+			 "the log is written by table_log_basic() and contains a TRUNCATE",
+			 restore_descr->orig_relname);
+	}
+
+	pfree(query.data);
+
+	return candidates;
+}
+
+/*
+  table_log_restore_table()
+
+  restore a complete table based on the logging table
+
+  parameter:
+  - original table name
+  - name of primary key in original table
+  - logging table
+  - name of primary key in logging table
+  - restore table name
+  - timestamp for restoring data
+  - primary key to restore (only this key will be restored) (optional)
+  - restore mode
+    0: restore from blank table (default)
+       needs a complete logging table
+    1: restore from actual table backwards
+    2: choose the cheaper of both (or a snapshot)
+       based on the planner's estimates
+  - dont create table temporarly
+    0: create restore table temporarly (default)
+    1: create restore table not temporarly
+    2: create restore table unlogged
+    3: create restore table not temporarly and register it for
+       table_log_refresh_restore()
+  return:
+    not yet defined
+*/
+Datum table_log_restore_table(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr restore_descr;
+
+	/* the primary key in the original table */
+	char  *table_orig_pkey;
+
+	/* cached columns of the original and log table */
+	TableLogRestoreColumns *columns;
+
+	/* the timestamp in past */
+	Datum      timestamp = PG_GETARG_DATUM(5);
+
+	/* the single pkey, can be null (then all keys will be restored) */
+	char  *search_pkey = "";
+
+	/* the restore method
+	   - 0: restore from blank table (default)
+	   needs a complete log table!
+	   - 1: restore from actual table backwards
+	   - 2: choose the cheapest starting point
+	*/
+	int            method = 0;
+	/* dont create restore table temporarly
+	   - 0: create restore table temporarly (default)
+	   - 1: dont create restore table temporarly
+	   - 2: create restore table unlogged
+	*/
+	int            not_temporarly = 0;
+	/* register the restore table for table_log_refresh_restore()? */
+	bool           refreshable = false;
+	int            ret, results, i, number_columns;
+	int64          applied = 0;                 /* log entries applied so far */
+
+    /*
+	 * for getting table infos
+	 */
+	StringInfo     query;
+
+	int            need_search_pkey = 0;          /* does we have a single key to restore? */
+	char           *timestamp_string;
+	char          **old_pkey_values = NULL;     /* old key of an UPDATE pair */
+	char          **search_pkey_values = NULL;  /* the single key split into its columns */
+	char           *trigger_mode;
+	char           *trigger_tuple;
+	char           *trigger_changed;
+	SPITupleTable  *spi_tuptable = NULL;          /* for saving query results */
+
+	/* memory for dynamic query */
+	StringInfo      d_query;
+
+	/* memory for column names */
+	StringInfo      col_query;
+
+	/* describes where the restore starts from */
+	TableLogStateQuery state;
+
+	/* positions of the pkey columns in the column list */
+	int     *col_pkeys;
+	int      num_pkeys;
+	int      j;
+
+	/*
+	 * Some checks first...
+	 */
+	elog(DEBUG2, "start table_log_restore_table()");
+
+  /* does we have all arguments? */
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_restore_table: missing original table name");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		/* NULL means: use all columns of the primary key */
+		table_orig_pkey = NULL;
+	}
+	else
+	{
+		table_orig_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(1));
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_restore_table: missing log table name");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_restore_table: missing primary key name for log table");
+	}
+	if (PG_ARGISNULL(4))
+	{
+		elog(ERROR, "table_log_restore_table: missing copy table name");
+	}
+	if (PG_ARGISNULL(5))
+	{
+		elog(ERROR, "table_log_restore_table: missing timestamp");
+	}
+
+	/* first check number arguments to avoid an segfault */
+	if (PG_NARGS() >= 7)
+	{
+		/* if argument is given, check if not null */
+		if (!PG_ARGISNULL(6))
+		{
+			/* yes, fetch it */
+			search_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(6));
+
+			/* and check, if we have an argument */
+			if (strlen(search_pkey) > 0)
+			{
+				need_search_pkey = 1;
+				elog(DEBUG2, "table_log_restore_table: will restore a single key");
+			}
+		}
+	} /* nargs >= 7 */
+
+	/* same procedere here */
+	if (PG_NARGS() >= 8)
+	{
+		if (!PG_ARGISNULL(7))
+		{
+			method = PG_GETARG_INT32(7);
+
+			if (method > 1)
+			{
+				method = 2;
+			}
+			else if (method > 0)
+			{
+				method = 1;
+			}
+			else
+			{
+				method = 0;
+			}
+		}
+	} /* nargs >= 8 */
+
+	if (method == 2)
+		elog(DEBUG2, "table_log_restore_table: will choose the cheapest restore method");
+	else if (method == 1)
+		elog(DEBUG2, "table_log_restore_table: will restore from actual state backwards");
+	else
+		elog(DEBUG2, "table_log_restore_table: will restore from begin forward");
+
+	if (PG_NARGS() >= 9)
+	{
+		if (!PG_ARGISNULL(8))
+		{
+			not_temporarly = PG_GETARG_INT32(8);
+
+			if (not_temporarly == 2)
+			{
+				elog(DEBUG2, "table_log_restore_table: create restore table unlogged");
+			}
+			else if (not_temporarly == 3)
+			{
+				not_temporarly = 1;
+				refreshable    = true;
+				elog(DEBUG2, "table_log_restore_table: register restore table for refreshing");
+			}
+			else if (not_temporarly > 0)
+			{
+				not_temporarly = 1;
+				elog(DEBUG2, "table_log_restore_table: dont create restore table temporarly");
+			}
+			else
+			{
+				not_temporarly = 0;
+			}
+		}
+ 	} /* nargs >= 9 */
+
+	/* get parameter and set them to the restore descriptor */
+
+	setTableLogRestoreDescr(&restore_descr,
+							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(0)),
+							table_orig_pkey,
+							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(2)),
+							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(3)),
+							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(4)));
+
+	/*
+	 * Rolling forward needs the new values of updates, which
+	 * table_log_basic() doesn't log.
+	 */
+	if (method == 0 && restore_descr.log_mode == TABLE_LOG_MODE_BASIC)
+	{
+		elog(ERROR, "table_log_restore_table: log table %s is written by table_log_basic(), "
+			 "only backward restores (method 1) are possible",
+			 RESTORE_TABLE_IDENT(restore_descr, log));
+	}
+
+	/*
+	 * A registered restore table must contain every log entry up to
+	 * the watermark, see registerRestoreTable(). Wait for running
+	 * changes of the original table, as table_log_snapshot() does,
+	 * so no entry below the watermark commits after the restore.
+	 * Only done if asked for, this blocks writers until the end of
+	 * the transaction.
+	 */
+	if (refreshable)
+	{
+		if (need_search_pkey)
+		{
+			elog(ERROR, "table_log_restore_table: a restore table of a single key can't be refreshed");
+		}
+
+		checkRefreshIsolation("table_log_restore_table");
+		LockRelationOid(restore_descr.orig_relid, ShareLock);
+	}
+
+	startRestoreProgress(restore_descr.orig_relid);
+
+	/*
+	 * Composite primary keys are handled by treating the key as a
+	 * list of column values throughout the replay. A single key to
+	 * restore is then expected as a row literal, e.g. '(1,foo)'.
+	 */
+	num_pkeys = restore_descr.orig_num_pk_attnums;
+
+	if (need_search_pkey == 1)
+	{
+		search_pkey_values = splitPrimaryKeyString(search_pkey, num_pkeys);
+	}
+
+	/* Connect to SPI manager */
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_restore_table: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * Check the tables and get the columns of the original table.
+	 * All of this comes from the relcache and syscache, the column
+	 * list is cached per pair of original and log table, see
+	 * getRestoreColumns().
+	 */
+	query = makeStringInfo();
+
+	/* check log table */
+	if (restore_descr.log_relid == InvalidOid)
+	{
+		elog(ERROR, "log table \"%s\" does not exist",
+			 RESTORE_TABLE_IDENT(restore_descr, log));
+	}
+
+	columns = getRestoreColumns(restore_descr.orig_relid,
+								restore_descr.log_relid);
+
+	/* check pkey in log table */
+	if (get_attnum(restore_descr.log_relid,
+				   restore_descr.pkey_log) == InvalidAttrNumber)
+	{
+		elog(ERROR, "could not check relation [4]: %s",
+			 RESTORE_TABLE_IDENT(restore_descr, log));
+	}
+
+	elog(DEBUG3, "log table: OK (%i columns)", columns->number_columns_log);
+
+	if (restore_descr.restore_relid != InvalidOid)
+	{
+		elog(ERROR, "restore table already exists: %s",
+			 RESTORE_TABLE_IDENT(restore_descr, restore));
+	}
+
+	elog(DEBUG2, "restore table: OK (doesn't exists)");
+
+	/* store number columns for later */
+	number_columns = columns->number_columns;
+
+	elog(DEBUG2, "number columns: %i", number_columns);
+
+	col_pkeys = (int *) palloc0(num_pkeys * sizeof(int));
+
+	for (i = 0; i < number_columns; i++)
+	{
+		/* now check, if this is part of the pkey */
+		for (j = 0; j < num_pkeys; j++)
+		{
+			if (strcmp((const char *)columns->col_names[i],
+					   (const char *)list_nth(restore_descr.orig_pk_attr_names, j)) == 0)
+			{
+				/* remember the (real) number */
+				col_pkeys[j] = i + 1;
+			}
+		}
+	}
+
+	/* check if we have found all pkey columns */
+	for (j = 0; j < num_pkeys; j++)
+	{
+		if (col_pkeys[j] == 0)
+		{
+			elog(ERROR, "cannot find pkey (%s) in table \"%s\"",
+				 (char *)list_nth(restore_descr.orig_pk_attr_names, j),
+				 restore_descr.orig_relname);
+		}
+	}
+
+	/* allocate memory for string */
+	col_query = makeStringInfo();
+	appendStringInfoString(col_query, columns->col_list);
+
+	/* get timestamp as string */
+	timestamp_string = DatumGetCString(DirectFunctionCall1(timestamptz_out, timestamp));
+
+	/*
+	 * Describe the restore: start from an empty table when rolling
+	 * forward or from the original table when rolling backward...
+	 */
+	state.base_ident         = (method == 1) ? (char *) quote_identifier(restore_descr.orig_relname) : NULL;
+	state.log_ident          = (char *) RESTORE_TABLE_IDENT(restore_descr, log);
+	state.log_pkey           = do_quote_ident(restore_descr.pkey_log);
+	state.col_list           = col_query->data;
+	state.pk_attr_names      = restore_descr.orig_pk_attr_names;
+	state.timestamp          = do_quote_literal(timestamp_string);
+	state.method             = method;
+	state.log_window         = NULL;
+	state.search_pkey_values = search_pkey_values;
+	state.search_keys        = NULL;
+	state.filter             = NULL;
+	state.log_mode           = restore_descr.log_mode;
+
+	if (method == 2)
+	{
+		TableLogRestoreCandidate *cheapest;
+
+		/*
+		 * Let the estimates decide where to start from...
+		 */
+		(void) getRestoreCandidates(&restore_descr, &state,
+									get_func_namespace(fcinfo->flinfo->fn_oid),
+									&cheapest);
+
+		state.base_ident = cheapest->base_ident;
+		state.method     = cheapest->method;
+		state.log_window = cheapest->log_window;
+	}
+	else
+	{
+		/*
+		 * ...unless there's a snapshot of the original table closer
+		 * to the timestamp.
+		 */
+		getRestoreSnapshot(&restore_descr, &state,
+						   get_func_namespace(fcinfo->flinfo->fn_oid));
+
+		/*
+		 * Rolling back a TRUNCATE needs the rows it removed, which
+		 * only the snapshot taken by the TRUNCATE has.
+		 */
+		if (state.method == 1)
+		{
+			resetStringInfo(query);
+			appendLogWindow(query, &state, NULL);
+
+			if (logHasTruncate(state.log_ident, state.pk_attr_names, query->data))
+			{
+				TableLogRestoreCandidate *cheapest;
+
+				elog(DEBUG2, "can't roll back over TRUNCATE, choosing another start");
+
+				(void) getRestoreCandidates(&restore_descr, &state,
+											get_func_namespace(fcinfo->flinfo->fn_oid),
+											&cheapest);
+
+				state.base_ident = cheapest->base_ident;
+				state.method     = cheapest->method;
+				state.log_window = cheapest->log_window;
+			}
+		}
+	}
+
+	checkLogChain(&state);
+
+	/*
+	 * With parallel workers enabled, compute the restore table with
+	 * a single set-based query instead of replaying the log. A chain
+	 * log has no old images to replay backward, it is always rolled
+	 * back that way.
+	 */
+	if (tableLogRestoreParallelWorkers > 0 ||
+		(state.method == 1 && state.log_mode == TABLE_LOG_MODE_CHAIN))
+	{
+		int save_nestlevel;
+
+		elog(DEBUG2, "create restore table with up to %d parallel workers: %s",
+			 tableLogRestoreParallelWorkers,
+			 RESTORE_TABLE_IDENT(restore_descr, restore));
+
+		resetStringInfo(query);
+		appendStringInfo(query, "SELECT * INTO %sTABLE %s FROM (",
+						 getRestoreTableOption(not_temporarly),
+						 RESTORE_TABLE_IDENT(restore_descr, restore));
+		appendRestoreStateQuery(query, &state);
+		appendStringInfoString(query, ") AS table_log_restore");
+
+		elog(DEBUG3, "query: %s", query->data);
+
+		save_nestlevel = setRestoreParallelWorkers(tableLogRestoreParallelWorkers);
+
+		setRestoreProgressPhase(TABLE_LOG_PROGRESS_BULK_LOADING, -1);
+
+		ret = SPI_exec(query->data, 0);
+
+		if (ret != SPI_OK_SELINTO)
+		{
+			elog(ERROR, "could not restore data into: %s",
+				 RESTORE_TABLE_IDENT(restore_descr, restore));
+		}
+
+		AtEOXact_GUC(true, save_nestlevel);
+
+		/* for moving the table later, see table_log_refresh_restore() */
+		createRestoreIndex(RESTORE_TABLE_IDENT(restore_descr, restore),
+						   restore_descr.orig_pk_attr_names);
+
+		if (refreshable)
+		{
+			registerRestoreTable(&restore_descr, &state,
+								 get_func_namespace(fcinfo->flinfo->fn_oid));
+		}
+
+		/* close SPI connection */
+		SPI_finish();
+
+		endRestoreProgress();
+
+		elog(DEBUG2, "table_log_restore_table() done, results in: %s",
+			 RESTORE_TABLE_IDENT(restore_descr, restore));
+
+		PG_RETURN_VARCHAR_P(cstring_to_text(RESTORE_TABLE_IDENT(restore_descr, restore)));
+	}
+
+	/* the replay direction might have been changed by a snapshot */
+	method = state.method;
+
+	/* create restore table */
+	setRestoreProgressPhase(TABLE_LOG_PROGRESS_COPYING_BASE, -1);
+
+	elog(DEBUG2, "string for columns: %s", col_query->data);
+	elog(DEBUG2, "create restore table: %s",
+		 RESTORE_TABLE_IDENT(restore_descr, restore));
+	resetStringInfo(query);
+	appendStringInfo(query, "SELECT * INTO ");
+
+	/* per default create a temporary table */
+	appendStringInfoString(query, getRestoreTableOption(not_temporarly));
+
+	/* from which table? */
+	appendStringInfo(query, "TABLE %s FROM %s ",
+					 RESTORE_TABLE_IDENT(restore_descr, restore),
+					 (state.base_ident != NULL) ? state.base_ident
+					 : quote_identifier(restore_descr.orig_relname));
+
+	if (need_search_pkey == 1)
+	{
+		/* only extract a specific key */
+		appendStringInfoString(query, "WHERE ");
+		appendPrimaryKeyPredicate(query,
+								  restore_descr.orig_pk_attr_names,
+								  search_pkey_values);
+		appendStringInfoChar(query, ' ');
+	}
+
+	if (state.base_ident == NULL)
+	{
+		/* restore from begin (blank table) */
+		appendStringInfo(query, "LIMIT 0");
+	}
+
+	elog(DEBUG3, "query: %s", query->data);
+
+	ret = SPI_exec(query->data, 0);
+
+	if (ret != SPI_OK_SELINTO)
+	{
+		elog(ERROR, "could not check relation: %s",
+			 RESTORE_TABLE_IDENT(restore_descr, restore));
+	}
+
+	/*
+	 * The replay looks up every key it updates or deletes. The index
+	 * is built after copying the base, which is cheaper than keeping
+	 * it up to date while copying.
+	 */
+	createRestoreIndex(RESTORE_TABLE_IDENT(restore_descr, restore),
+					   restore_descr.orig_pk_attr_names);
+
+	if (method == 0)
+		elog(DEBUG2, "need logs from start to timestamp: %s", timestamp_string);
+	else
+		elog(DEBUG2, "need logs from end to timestamp: %s", timestamp_string);
+
+	/* now build query for getting logs */
+	elog(DEBUG2, "build query for getting logs");
+
+	/* allocate memory for string and build query */
+	d_query = makeStringInfo();
+
+	elog(DEBUG2, "using log table %s",
+		 RESTORE_TABLE_IDENT(restore_descr, log));
+
+	appendStringInfo(d_query,
+					 "SELECT %s, trigger_mode, trigger_tuple, trigger_changed FROM %s WHERE ",
+					 col_query->data,
+					 RESTORE_TABLE_IDENT(restore_descr, log));
+
+	/*
+	 * From start to timestamp or from now() backwards to timestamp,
+	 * restricted to the log entries not contained in the snapshot
+	 * we start from.
+	 */
+	appendLogWindow(d_query, &state, NULL);
+	appendStringInfoChar(d_query, ' ');
+
+	if (need_search_pkey == 1)
+	{
+		/* TRUNCATE markers remove the key as well */
+		appendStringInfoString(d_query, "AND (");
+		appendPrimaryKeyPredicate(d_query,
+								  restore_descr.orig_pk_attr_names,
+								  search_pkey_values);
+		appendStringInfoString(d_query, " OR ");
+		appendTruncateMarker(d_query, restore_descr.orig_pk_attr_names, NULL);
+		appendStringInfoString(d_query, ") ");
+	}
+
+	if (method == 0)
+	{
+		appendStringInfo(d_query, "ORDER BY %s ASC",
+						 do_quote_ident(restore_descr.pkey_log));
+	}
+	else
+	{
+		appendStringInfo(d_query, "ORDER BY %s DESC",
+						 do_quote_ident(restore_descr.pkey_log));
+	}
+
+	elog(DEBUG3, "query: %s", d_query->data);
+
+	/* the estimate is only needed if anyone can see it */
+	setRestoreProgressPhase(TABLE_LOG_PROGRESS_SCANNING_LOG,
+							(tableLogMyProgress != NULL)
+							? (int64) estimateQueryRows(d_query->data) : -1);
+
+	ret = SPI_exec(d_query->data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not get log data from table: %s",
+			 RESTORE_TABLE_IDENT(restore_descr, log));
+	}
+
+	results = SPI_processed;
+	/* save results */
+	spi_tuptable = SPI_tuptable;
+
+	setRestoreProgressPhase(TABLE_LOG_PROGRESS_REPLAYING, results);
+
+	/* go through all results */
+	for (i = 0; i < results; i++)
+	{
+		if (applied > 0 && applied % TABLE_LOG_PROGRESS_INTERVAL == 0)
+			updateRestoreProgress(applied);
+
+		/* get tuple data */
+		trigger_mode = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 1);
+		trigger_tuple = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 2);
+		trigger_changed = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 3);
+
+		/* check for update tuples we doesnt need */
+		if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
+		{
+			if (method == 0 && strcmp((const char *)trigger_tuple, (const char *)"old") == 0)
+			{
+				/* we need the old value of the pkey for the update */
+				old_pkey_values = getPrimaryKeyValues(spi_tuptable, col_pkeys, num_pkeys, i);
+				elog(DEBUG2, "tuple old pkey: %s", old_pkey_values[0]);
+
+				/* then skip this tuple */
+				continue;
+			}
+
+			if (method == 1 && strcmp((const char *)trigger_tuple, (const char *)"new") == 0)
+			{
+				/* we need the old value of the pkey for the update */
+				old_pkey_values = getPrimaryKeyValues(spi_tuptable, col_pkeys, num_pkeys, i);
+				elog(DEBUG2, "tuple: old pkey: %s", old_pkey_values[0]);
+
+				/* then skip this tuple */
+				continue;
+			}
+
+			if (method == 1 && restore_descr.log_mode == TABLE_LOG_MODE_BASIC)
+			{
+				/*
+				 * No new tuple precedes the old one in a basic log,
+				 * the key is assumed to be unchanged.
+				 */
+				old_pkey_values = getPrimaryKeyValues(spi_tuptable, col_pkeys, num_pkeys, i);
+			}
+		}
+
+		if (method == 0)
+		{
+			/* roll forward */
+			elog(DEBUG2, "tuple: %s  %s  %s", trigger_mode, trigger_tuple, trigger_changed);
+
+			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
+			{
+				__table_log_restore_table_insert(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i);
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
+			{
+				__table_log_restore_table_update(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i,
+												 old_pkey_values);
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
+			{
+				__table_log_restore_table_delete(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i);
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"TRUNCATE") == 0)
+			{
+				resetStringInfo(query);
+				appendStringInfo(query, "DELETE FROM %s",
+								 RESTORE_TABLE_IDENT(restore_descr, restore));
+
+				elog(DEBUG3, "query: %s", query->data);
+
+				if (SPI_exec(query->data, 0) != SPI_OK_DELETE)
+				{
+					elog(ERROR, "could not delete data from: %s",
+						 RESTORE_TABLE_IDENT(restore_descr, restore));
+				}
+			}
+			else
+			{
+				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
+			}
+
+		}
+		else
+		{
+			/* roll back */
+			char rb_mode[10]; /* reverse the method */
+
+			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
+			{
+				sprintf(rb_mode, "DELETE");
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
+			{
+				sprintf(rb_mode, "UPDATE");
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
+			{
+				sprintf(rb_mode, "INSERT");
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"TRUNCATE") == 0)
+			{
+				/* prevented by choosing the start, see above */
+				elog(ERROR, "cannot roll back TRUNCATE in relation: %s",
+					 restore_descr.orig_relname);
+			}
+			else
+			{
+				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
+			}
+
+			elog(DEBUG2, "tuple: %s  %s  %s", rb_mode, trigger_tuple, trigger_changed);
+
+			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
+			{
+				__table_log_restore_table_delete(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i);
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
+			{
+				__table_log_restore_table_update(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i,
+												 old_pkey_values);
+			}
+			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
+			{
+				__table_log_restore_table_insert(spi_tuptable,
+												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
+												 restore_descr.orig_pk_attr_names,
+												 col_query->data,
+												 col_pkeys,
+												 number_columns,
+												 i);
+			}
+		}
+
+		applied++;
+	}
+
+	updateRestoreProgress(applied);
+
+	/* remember how far the table was restored, see table_log_refresh_restore() */
+	if (refreshable)
+	{
+		registerRestoreTable(&restore_descr, &state,
+							 get_func_namespace(fcinfo->flinfo->fn_oid));
+	}
+
+	/* close SPI connection */
+	SPI_finish();
+
+	endRestoreProgress();
+
+	elog(DEBUG2, "table_log_restore_table() done, results in: %s",
+		 RESTORE_TABLE_IDENT(restore_descr, restore));
+
+	/* and return the name of the restore table */
+	PG_RETURN_VARCHAR_P(cstring_to_text(RESTORE_TABLE_IDENT(restore_descr, restore)));
+}
+
+/*
+  table_log_explain_restore()
+
+  show the possible starting points of a restore with
+  table_log_restore_table() and the estimated number of rows
+  to process for each of them, without restoring anything
+
+  parameter:
+  - original table name
+  - name of primary key in original table (or NULL)
+  - logging table
+  - name of primary key in logging table
+  - timestamp for restoring data
+  - primary key to restore (optional)
+  return:
+    one row per starting point, the one chosen by the
+    restore method 2 is flagged
+*/
+Datum table_log_explain_restore(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr      restore_descr;
+	TableLogStateQuery        state;
+	TableLogRestoreCandidate *cheapest;
+	ReturnSetInfo            *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc                 tupdesc;
+	Tuplestorestate          *tupstore;
+	MemoryContext             oldcontext;
+	List                     *candidates;
+	ListCell                 *scan;
+	char                     *search_pkey = NULL;
+	int                       ret;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_explain_restore: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		elog(ERROR, "table_log_explain_restore: materialize mode required, but it is not allowed in this context");
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "table_log_explain_restore: return type must be a row type");
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_explain_restore: missing original table name");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_explain_restore: missing log table name");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_explain_restore: missing primary key name for log table");
+	}
+	if (PG_ARGISNULL(4))
+	{
+		elog(ERROR, "table_log_explain_restore: missing timestamp");
+	}
+	if (PG_NARGS() >= 6 && !PG_ARGISNULL(5))
+	{
+		search_pkey = __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(5));
+
+		if (strlen(search_pkey) == 0)
+			search_pkey = NULL;
+	}
+
+	setTableLogRestoreDescr(&restore_descr,
 							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(0)),
-							((table_orig_pkey != NULL) ? __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(1)) : NULL),
+							PG_ARGISNULL(1) ? NULL
+							: __table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(1)),
 							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(2)),
 							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(3)),
-							__table_log_varcharout((VarChar *)PG_GETARG_VARCHAR_P(4)));
+							NULL);
+
+	if (restore_descr.log_relid == InvalidOid)
+	{
+		elog(ERROR, "log table \"%s\" does not exist",
+			 RESTORE_TABLE_IDENT(restore_descr, log));
+	}
+
+	/*
+	 * Only the parts of the state needed for the estimates.
+	 */
+	state.base_ident         = NULL;
+	state.log_ident          = (char *) RESTORE_TABLE_IDENT(restore_descr, log);
+	state.log_pkey           = do_quote_ident(restore_descr.pkey_log);
+	state.col_list           = NULL;
+	state.pk_attr_names      = restore_descr.orig_pk_attr_names;
+	state.timestamp          = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																				   PG_GETARG_DATUM(4))));
+	state.method             = 2;
+	state.log_window         = NULL;
+	state.search_pkey_values = (search_pkey != NULL)
+		? splitPrimaryKeyString(search_pkey, restore_descr.orig_num_pk_attnums)
+		: NULL;
+	state.search_keys        = NULL;
+	state.filter             = NULL;
+	state.log_mode           = restore_descr.log_mode;
+
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_explain_restore: SPI_connect returned %d", ret);
+	}
+
+	candidates = getRestoreCandidates(&restore_descr, &state,
+									  get_func_namespace(fcinfo->flinfo->fn_oid),
+									  &cheapest);
+
+	foreach(scan, candidates)
+	{
+		TableLogRestoreCandidate *candidate = (TableLogRestoreCandidate *) lfirst(scan);
+		Datum values[6];
+		bool  nulls[6];
+
+		memset(nulls, 0, sizeof(nulls));
+
+		if (candidate->base_ident != NULL)
+			values[0] = CStringGetTextDatum(candidate->base_ident);
+		else
+			nulls[0] = true;
+
+		values[1] = Int32GetDatum(candidate->method);
+		values[2] = Float8GetDatum(candidate->base_rows);
+		values[3] = Float8GetDatum(candidate->log_rows);
+		values[4] = Float8GetDatum(candidate->base_rows + candidate->log_rows);
+		values[5] = BoolGetDatum(candidate == cheapest);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+  table_log_as_of()
+
+  return the rows of a table as they were at a timestamp
+  in the past, without creating a restore table
+
+  parameter:
+  - original table
+  - logging table
+  - timestamp for restoring data
+  - primary key to restore (optional)
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    the rows of the original table, the caller has to specify
+    the columns of the original table in a column definition list
+*/
+Datum table_log_as_of(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr      restore_descr;
+	TableLogStateQuery        state;
+	TableLogRestoreCandidate *cheapest;
+	ReturnSetInfo            *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc                 tupdesc;
+	TupleDesc                 orig_tupdesc;
+	Tuplestorestate          *tupstore;
+	MemoryContext             oldcontext;
+	Relation                  origRel;
+	StringInfoData            col_list;
+	StringInfoData            query;
+	SPIPlanPtr                plan;
+	Portal                    portal;
+	int                       ret, i, j;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_as_of: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		elog(ERROR, "table_log_as_of: materialize mode required, but it is not allowed in this context");
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "table_log_as_of: a column definition list is required");
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_as_of: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_as_of: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_as_of: missing timestamp");
+	}
+
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+	restore_descr.pkey_log = (PG_NARGS() >= 5 && !PG_ARGISNULL(4))
+		? text_to_cstring(PG_GETARG_TEXT_PP(4)) : "trigger_id";
+
+	/*
+	 * The column definition list must match the columns
+	 * of the original table, since we return its rows as they are.
+	 */
+#if PG_VERSION_NUM >= 120000
+	origRel = table_open(restore_descr.orig_relid, AccessShareLock);
+#else
+	origRel = heap_open(restore_descr.orig_relid, AccessShareLock);
+#endif
+	orig_tupdesc = RelationGetDescr(origRel);
+
+	initStringInfo(&col_list);
+
+	for (i = 0, j = 0; i < orig_tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(orig_tupdesc, i);
+
+		if (attr->attisdropped)
+			continue;
+
+		if (j >= tupdesc->natts
+			|| TupleDescAttr(tupdesc, j)->atttypid != attr->atttypid)
+		{
+			elog(ERROR, "table_log_as_of: column definition list doesn't match table \"%s\"",
+				 restore_descr.orig_relname);
+		}
+
+		if (j > 0)
+			appendStringInfoString(&col_list, ", ");
+
+		appendStringInfoString(&col_list, quote_identifier(NameStr(attr->attname)));
+		j++;
+	}
+
+	if (j != tupdesc->natts)
+	{
+		elog(ERROR, "table_log_as_of: column definition list doesn't match table \"%s\"",
+			 restore_descr.orig_relname);
+	}
+
+#if PG_VERSION_NUM >= 120000
+	table_close(origRel, AccessShareLock);
+#else
+	heap_close(origRel, AccessShareLock);
+#endif
+
+	state.base_ident         = NULL;
+	state.log_ident          = DatumGetCString(DirectFunctionCall1(regclassout,
+																   ObjectIdGetDatum(restore_descr.log_relid)));
+	state.log_pkey           = do_quote_ident(restore_descr.pkey_log);
+	state.col_list           = col_list.data;
+	state.pk_attr_names      = restore_descr.orig_pk_attr_names;
+	state.timestamp          = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																				   PG_GETARG_DATUM(2))));
+	state.method             = 2;
+	state.log_window         = NULL;
+	state.search_pkey_values = (PG_NARGS() >= 4 && !PG_ARGISNULL(3))
+		? splitPrimaryKeyString(text_to_cstring(PG_GETARG_TEXT_PP(3)),
+								restore_descr.orig_num_pk_attnums)
+		: NULL;
+	state.search_keys        = NULL;
+	state.filter             = NULL;
+	state.log_mode           = restore_descr.log_mode;
+
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_as_of: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * Start from wherever the least rows have to be read.
+	 */
+	(void) getRestoreCandidates(&restore_descr, &state,
+								get_func_namespace(fcinfo->flinfo->fn_oid),
+								&cheapest);
+
+	state.base_ident = cheapest->base_ident;
+	state.method     = cheapest->method;
+	state.log_window = cheapest->log_window;
+
+	checkLogChain(&state);
+
+	initStringInfo(&query);
+	appendRestoreStateQuery(&query, &state);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	/*
+	 * Read the rows through a read-only cursor, so this works
+	 * on a hot standby and we don't keep the whole result in
+	 * SPI memory.
+	 */
+	plan = SPI_prepare(query.data, 0, NULL);
+
+	if (plan == NULL)
+	{
+		elog(ERROR, "table_log_as_of: SPI_prepare returned %d", SPI_result);
+	}
+
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+	for (;;)
+	{
+		uint64 k;
+
+		SPI_cursor_fetch(portal, true, 1000);
+
+		if (SPI_processed == 0)
+			break;
+
+		for (k = 0; k < SPI_processed; k++)
+			tuplestore_puttuple(tupstore, SPI_tuptable->vals[k]);
+
+		SPI_freetuptable(SPI_tuptable);
+	}
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * Returns the saved plan of the query for table_log_row_history()
+ * for the given pair of relations, preparing it if it isn't
+ * cached yet or was prepared for another query text. The caller
+ * must be connected to SPI.
+ */
+static SPIPlanPtr getRowHistoryPlan(TableLogRelPair *key,
+									char *query,
+									int nargs,
+									Oid *argtypes)
+{
+	TableLogHistoryPlan *entry;
+	SPIPlanPtr           plan;
+	bool                 found;
+
+	if (tableLogHistoryPlans == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize   = sizeof(TableLogRelPair);
+		ctl.entrysize = sizeof(TableLogHistoryPlan);
+
+		tableLogHistoryPlans = hash_create("table_log row history plans",
+										   16, &ctl,
+										   HASH_ELEM | HASH_BLOBS);
+	}
+
+	entry = (TableLogHistoryPlan *) hash_search(tableLogHistoryPlans,
+												key, HASH_ENTER, &found);
+
+	if (found
+		&& entry->query != NULL
+		&& strcmp(entry->query, query) == 0)
+	{
+		return entry->plan;
+	}
+
+	if (found && entry->plan != NULL)
+		SPI_freeplan(entry->plan);
+	if (found && entry->query != NULL)
+		pfree(entry->query);
+
+	/*
+	 * An entry without query text is never used, so this
+	 * is safe if preparing the query fails below.
+	 */
+	entry->query = NULL;
+	entry->plan  = NULL;
+
+	plan = SPI_prepare(query, nargs, argtypes);
+
+	if (plan == NULL)
+	{
+		elog(ERROR, "table_log_row_history: SPI_prepare returned %d", SPI_result);
+	}
+
+	if (SPI_keepplan(plan) != 0)
+	{
+		elog(ERROR, "table_log_row_history: SPI_keepplan failed");
+	}
+
+	entry->plan  = plan;
+	entry->query = MemoryContextStrdup(TopMemoryContext, query);
+
+	return entry->plan;
+}
+
+/*
+  table_log_row_history()
+
+  return all logged versions of a single row, ordered by
+  the primary key of the logging table
+
+  parameter:
+  - original table
+  - logging table
+  - primary key to show
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    the matching rows of the logging table, the caller selects
+    the columns of the logging table to return with a column
+    definition list
+*/
+Datum table_log_row_history(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr restore_descr;
+	TableLogRelPair   key;
+	ReturnSetInfo       *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc            tupdesc;
+	Tuplestorestate     *tupstore;
+	MemoryContext        oldcontext;
+	StringInfoData       query;
+	SPIPlanPtr           plan;
+	char               **pk_values;
+	Oid                 *argtypes;
+	Datum               *values;
+	char                *pkey_log;
+	uint64               k;
+	int                  ret, i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_row_history: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		elog(ERROR, "table_log_row_history: materialize mode required, but it is not allowed in this context");
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "table_log_row_history: a column definition list is required");
+	}
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_row_history: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_row_history: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_row_history: missing primary key");
+	}
+
+	key.orig_relid = PG_GETARG_OID(0);
+	key.log_relid  = PG_GETARG_OID(1);
+	pkey_log       = (PG_NARGS() >= 4 && !PG_ARGISNULL(3))
+		? text_to_cstring(PG_GETARG_TEXT_PP(3)) : "trigger_id";
+
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 key.orig_relid,
+								 key.log_relid);
+
+	pk_values = splitPrimaryKeyString(text_to_cstring(PG_GETARG_TEXT_PP(2)),
+									  restore_descr.orig_num_pk_attnums);
+
+	/*
+	 * Select the columns of the column definition list, which
+	 * must exist in the log table with the same type.
+	 */
+	initStringInfo(&query);
+	appendStringInfoString(&query, "SELECT ");
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		AttrNumber        attnum;
+
+		attnum = get_attnum(key.log_relid, NameStr(attr->attname));
+
+		if (attnum == InvalidAttrNumber
+			|| get_atttype(key.log_relid, attnum) != attr->atttypid)
+		{
+			elog(ERROR, "table_log_row_history: column \"%s\" of type %s does not exist in log table",
+				 NameStr(attr->attname),
+				 format_type_be(attr->atttypid));
+		}
+
+		if (i > 0)
+			appendStringInfoString(&query, ", ");
+
+		appendStringInfoString(&query, quote_identifier(NameStr(attr->attname)));
+	}
+
+	/*
+	 * The key values are passed as text and cast to the types of the
+	 * key columns, so an index on the key columns and the log primary key
+	 * can return the versions in order.
+	 */
+	appendStringInfo(&query, " FROM %s WHERE (",
+					 DatumGetCString(DirectFunctionCall1(regclassout,
+														 ObjectIdGetDatum(key.log_relid))));
+	appendKeyColumnList(&query, restore_descr.orig_pk_attr_names, NULL);
+	appendStringInfoString(&query, ") = (");
+
+	argtypes = (Oid *) palloc(restore_descr.orig_num_pk_attnums * sizeof(Oid));
+	values   = (Datum *) palloc(restore_descr.orig_num_pk_attnums * sizeof(Datum));
+
+	for (i = 0; i < restore_descr.orig_num_pk_attnums; i++)
+	{
+		AttrNumber attnum = get_attnum(key.log_relid,
+									   list_nth(restore_descr.orig_pk_attr_names, i));
+
+		if (attnum == InvalidAttrNumber)
+		{
+			elog(ERROR, "cannot find pkey (%s) in log table",
+				 (char *) list_nth(restore_descr.orig_pk_attr_names, i));
+		}
+
+		if (i > 0)
+			appendStringInfoString(&query, ", ");
+
+		appendStringInfo(&query, "$%d::%s",
+						 i + 1,
+						 format_type_be(get_atttype(key.log_relid, attnum)));
+
+		argtypes[i] = TEXTOID;
+		values[i]   = CStringGetTextDatum(pk_values[i]);
+	}
+
+	appendStringInfo(&query, ") ORDER BY %s", do_quote_ident(pkey_log));
+
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_row_history: SPI_connect returned %d", ret);
+	}
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	plan = getRowHistoryPlan(&key, query.data,
+							 restore_descr.orig_num_pk_attnums, argtypes);
+
+	ret = SPI_execute_plan(plan, values, NULL, true, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "table_log_row_history: SPI_execute_plan returned %d", ret);
+	}
+
+	for (k = 0; k < SPI_processed; k++)
+		tuplestore_puttuple(tupstore, SPI_tuptable->vals[k]);
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * Returns the names of all (not dropped) columns of the
+ * specified relation.
+ */
+static List *getRelationColumnNames(Oid relid)
+{
+	Relation  rel;
+	TupleDesc tupdesc;
+	List     *col_names = NIL;
+	int       i;
+
+#if PG_VERSION_NUM >= 120000
+	rel = table_open(relid, AccessShareLock);
+#else
+	rel = heap_open(relid, AccessShareLock);
+#endif
+	tupdesc = RelationGetDescr(rel);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+		if (attr->attisdropped)
+			continue;
+
+		col_names = lappend(col_names, pstrdup(NameStr(attr->attname)));
+	}
+
+#if PG_VERSION_NUM >= 120000
+	table_close(rel, AccessShareLock);
+#else
+	heap_close(rel, AccessShareLock);
+#endif
+
+	return col_names;
+}
+
+/*
+ * Returns the columns of the original and the log table for
+ * table_log_restore_table(). They are taken from the relcache
+ * and kept until either relation is changed, so repeated restores
+ * of the same table don't need any catalog queries.
+ */
+static TableLogRestoreColumns *getRestoreColumns(Oid orig_relid,
+												 Oid log_relid)
+{
+	TableLogRestoreColumns *entry;
+	TableLogRelPair         key;
+	Relation                rel;
+	TupleDesc               tupdesc;
+	StringInfoData          col_list;
+	bool                    found;
+	int                     i;
+
+	/*
+	 * Lock both relations first, this processes pending
+	 * invalidations and so clears an outdated entry.
+	 */
+	LockRelationOid(orig_relid, AccessShareLock);
+	LockRelationOid(log_relid, AccessShareLock);
+
+	if (tableLogRestoreColumns == NULL)
+	{
+		HASHCTL ctl;
+
+		memset(&ctl, 0, sizeof(ctl));
+		ctl.keysize   = sizeof(TableLogRelPair);
+		ctl.entrysize = sizeof(TableLogRestoreColumns);
+
+		tableLogRestoreColumns = hash_create("table_log restore columns",
+											 16, &ctl,
+											 HASH_ELEM | HASH_BLOBS);
+	}
+
+	memset(&key, 0, sizeof(key));
+	key.orig_relid = orig_relid;
+	key.log_relid  = log_relid;
+
+	entry = (TableLogRestoreColumns *) hash_search(tableLogRestoreColumns,
+												   &key, HASH_ENTER, &found);
+
+	if (found && entry->valid)
+		return entry;
+
+	if (found && entry->col_names != NULL)
+	{
+		for (i = 0; i < entry->number_columns; i++)
+			pfree(entry->col_names[i]);
+		pfree(entry->col_names);
+	}
+	if (found && entry->col_list != NULL)
+		pfree(entry->col_list);
+
+	/*
+	 * An invalid entry is rebuilt on the next call, so this
+	 * is safe if any of the checks below fails.
+	 */
+	entry->valid              = false;
+	entry->number_columns     = 0;
+	entry->col_names          = NULL;
+	entry->col_list           = NULL;
+	entry->number_columns_log = 0;
+
+	/* the log table */
+	if (get_rel_relkind(log_relid) != RELKIND_RELATION
+		&& get_rel_relkind(log_relid) != RELKIND_VIEW)
+	{
+		elog(ERROR, "could not check relation [2]: %s",
+			 DatumGetCString(DirectFunctionCall1(regclassout,
+												 ObjectIdGetDatum(log_relid))));
+	}
+
+	entry->number_columns_log = list_length(getRelationColumnNames(log_relid));
+
+	if (entry->number_columns_log == 0)
+	{
+		elog(ERROR, "could not check relation [2]: %s",
+			 DatumGetCString(DirectFunctionCall1(regclassout,
+												 ObjectIdGetDatum(log_relid))));
+	}
+
+	/* the original table */
+#if PG_VERSION_NUM >= 120000
+	rel = table_open(orig_relid, AccessShareLock);
+#else
+	rel = heap_open(orig_relid, AccessShareLock);
+#endif
+	tupdesc = RelationGetDescr(rel);
+
+	entry->col_names = (char **) MemoryContextAllocZero(TopMemoryContext,
+														Max(tupdesc->natts, 1) * sizeof(char *));
+	initStringInfo(&col_list);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+
+		if (attr->attisdropped)
+			continue;
+
+		if (entry->number_columns > 0)
+			appendStringInfoString(&col_list, ", ");
+		appendStringInfoString(&col_list, quote_identifier(NameStr(attr->attname)));
+
+		entry->col_names[entry->number_columns++] =
+			MemoryContextStrdup(TopMemoryContext, NameStr(attr->attname));
+	}
+
+#if PG_VERSION_NUM >= 120000
+	table_close(rel, AccessShareLock);
+#else
+	heap_close(rel, AccessShareLock);
+#endif
+
+	if (entry->number_columns == 0)
+	{
+		elog(ERROR, "could not check relation: \"%s\"",
+			 DatumGetCString(DirectFunctionCall1(regclassout,
+												 ObjectIdGetDatum(orig_relid))));
+	}
+
+	entry->col_list = MemoryContextStrdup(TopMemoryContext, col_list.data);
+	pfree(col_list.data);
+
+	entry->valid = true;
+
+	return entry;
+}
+
+/*
+ * Relcache invalidation callback, marks the cached columns
+ * of the changed relation as invalid. An invalid relid means
+ * the whole relcache was reset.
+ */
+static void invalidateRestoreColumns(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS         status;
+	TableLogRestoreColumns *entry;
+
+	if (tableLogRestoreColumns == NULL)
+		return;
+
+	hash_seq_init(&status, tableLogRestoreColumns);
+
+	while ((entry = (TableLogRestoreColumns *) hash_seq_search(&status)) != NULL)
+	{
+		if (relid == InvalidOid
+			|| entry->key.orig_relid == relid
+			|| entry->key.log_relid == relid)
+		{
+			entry->valid = false;
+		}
+	}
+}
+
+/*
+ * Moves the target table along the log by applying the log
+ * entries selected by log_window (a condition on the log table)
+ * to the keys they touch. All other rows of the target are left alone.
+ *
+ * Rolling forward, the last selected entry of each key decides:
+ * a "new" tuple is its image afterwards, an "old" tuple means the key
+ * was deleted. Rolling backward, the first selected entry decides: an
+ * "old" tuple is its image before, a "new" tuple means the key didn't
+ * exist yet. Keys which don't exist are deleted from the target, rows
+ * which differ from their image are updated and missing keys are
+ * inserted.
+ *
+ * The target is locked against concurrent changes. Returns the number
+ * of rows changed. Errors out if the log entries contain a TRUNCATE
+ * marker. The caller must be connected to SPI.
+ */
+static int64 applyLogDelta(char *target_ident,
+						   char *log_ident,
+						   char *log_pkey,
+						   List *pk_attr_names,
+						   List *col_names,
+						   char *log_window,
+						   bool forward)
+{
+	StringInfoData state_query;
+	StringInfoData query;
+	ListCell      *scan;
+	const char    *exists_tuple = forward ? "'new'" : "'old'";
+	int64          changed = 0;
+	bool           first;
+
+	/*
+	 * A TRUNCATE touches all keys, moving the target over it
+	 * is no cheaper than restoring the table again.
+	 */
+	if (logHasTruncate(log_ident, pk_attr_names, log_window))
+	{
+		elog(ERROR, "cannot move %s over a TRUNCATE, restore the table again",
+			 target_ident);
+	}
+
+	/*
+	 * The deciding log entry of each key touched.
+	 */
+	initStringInfo(&state_query);
+	appendStringInfoString(&state_query, "SELECT DISTINCT ON (");
+	appendKeyColumnList(&state_query, pk_attr_names, NULL);
+	appendStringInfoString(&state_query, ") ");
+	appendKeyColumnList(&state_query, col_names, NULL);
+	appendStringInfo(&state_query,
+					 ", trigger_tuple FROM %s WHERE %s ORDER BY ",
+					 log_ident,
+					 log_window);
+	appendKeyColumnList(&state_query, pk_attr_names, NULL);
+	appendStringInfo(&state_query, ", %s %s",
+					 log_pkey,
+					 forward ? "DESC" : "ASC");
+
+	/*
+	 * Concurrent changes would be mixed up with the delta,
+	 * but readers may continue.
+	 */
+	initStringInfo(&query);
+	appendStringInfo(&query, "LOCK TABLE %s IN EXCLUSIVE MODE", target_ident);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_UTILITY)
+	{
+		elog(ERROR, "could not lock relation %s", target_ident);
+	}
+
+	/*
+	 * Remove the keys which don't exist...
+	 */
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "DELETE FROM %s AS t USING (%s) AS s "
+					 "WHERE s.trigger_tuple <> %s AND (",
+					 target_ident,
+					 state_query.data,
+					 exists_tuple);
+	appendKeyColumnList(&query, pk_attr_names, "t");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, pk_attr_names, "s");
+	appendStringInfoChar(&query, ')');
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_DELETE)
+	{
+		elog(ERROR, "could not change relation %s", target_ident);
+	}
+
+	changed += SPI_processed;
+
+	/*
+	 * ...reset the changed keys, skipping rows which already
+	 * have their image...
+	 */
+	resetStringInfo(&query);
+	appendStringInfo(&query, "UPDATE %s AS t SET ", target_ident);
+
+	first = true;
+	foreach(scan, col_names)
+	{
+		char *col_name = do_quote_ident((char *) lfirst(scan));
+
+		appendStringInfo(&query, "%s%s = s.%s",
+						 first ? "" : ", ",
+						 col_name,
+						 col_name);
+		first = false;
+	}
+
+	appendStringInfo(&query,
+					 " FROM (%s) AS s WHERE s.trigger_tuple = %s AND (",
+					 state_query.data,
+					 exists_tuple);
+	appendKeyColumnList(&query, pk_attr_names, "t");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, pk_attr_names, "s");
+	appendStringInfoString(&query, ") AND ROW(");
+	appendKeyColumnList(&query, col_names, "t");
+	appendStringInfoString(&query, ")::text IS DISTINCT FROM ROW(");
+	appendKeyColumnList(&query, col_names, "s");
+	appendStringInfoString(&query, ")::text");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not change relation %s", target_ident);
+	}
+
+	changed += SPI_processed;
+
+	/*
+	 * ...and add the missing keys.
+	 */
+	resetStringInfo(&query);
+	appendStringInfo(&query, "INSERT INTO %s (", target_ident);
+	appendKeyColumnList(&query, col_names, NULL);
+	appendStringInfoString(&query, ") SELECT ");
+	appendKeyColumnList(&query, col_names, "s");
+	appendStringInfo(&query,
+					 " FROM (%s) AS s WHERE s.trigger_tuple = %s "
+					 "AND NOT EXISTS (SELECT 1 FROM %s AS t WHERE (",
+					 state_query.data,
+					 exists_tuple,
+					 target_ident);
+	appendKeyColumnList(&query, pk_attr_names, "t");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, pk_attr_names, "s");
+	appendStringInfoString(&query, "))");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_INSERT)
+	{
+		elog(ERROR, "could not change relation %s", target_ident);
+	}
+
+	changed += SPI_processed;
+
+	pfree(state_query.data);
+	pfree(query.data);
+
+	return changed;
+}
+
+/*
+  table_log_rewind()
+
+  rewind a table to a timestamp in the past by applying the
+  inverse of the log entries written after the timestamp, so
+  only the rows changed since then are touched
+
+  parameter:
+  - original table
+  - logging table
+  - timestamp to rewind to
+  - target table (optional, defaults to the original table)
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    number of rows deleted, updated and inserted
+*/
+Datum table_log_rewind(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr restore_descr;
+	Oid                  target_relid;
+	char                *target_ident;
+	char                *log_ident;
+	char                *log_pkey;
+	char                *timestamp;
+	List                *col_names;
+	StringInfoData       log_window;
+	int64                changed;
+	int                  ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_rewind: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_rewind: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_rewind: missing timestamp");
+	}
+
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+
+	if (restore_descr.log_mode == TABLE_LOG_MODE_CHAIN)
+	{
+		elog(ERROR, "table_log_rewind: log table of \"%s\" is written by table_log_chain(), "
+			 "which has no old images to roll back",
+			 restore_descr.orig_relname);
+	}
+
+	target_relid = (PG_NARGS() >= 4 && !PG_ARGISNULL(3))
+		? PG_GETARG_OID(3) : restore_descr.orig_relid;
+
+	if (get_rel_name(target_relid) == NULL)
+	{
+		elog(ERROR, "lookup for relation %u failed", target_relid);
+	}
+
+	target_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+													   ObjectIdGetDatum(target_relid)));
+	log_ident    = DatumGetCString(DirectFunctionCall1(regclassout,
+													   ObjectIdGetDatum(restore_descr.log_relid)));
+	log_pkey     = do_quote_ident((PG_NARGS() >= 5 && !PG_ARGISNULL(4))
+								  ? text_to_cstring(PG_GETARG_TEXT_PP(4)) : "trigger_id");
+	timestamp    = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		PG_GETARG_DATUM(2))));
+	col_names    = getRelationColumnNames(restore_descr.orig_relid);
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_rewind: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * Undo all log entries after the timestamp.
+	 */
+	initStringInfo(&log_window);
+	appendStringInfo(&log_window, "trigger_changed > %s", timestamp);
+
+	changed = applyLogDelta(target_ident,
+							log_ident,
+							log_pkey,
+							restore_descr.orig_pk_attr_names,
+							col_names,
+							log_window.data,
+							false);
+
+	SPI_finish();
+
+	elog(DEBUG2, "table_log_rewind() done, " INT64_FORMAT " rows changed in %s",
+		 changed, target_ident);
+
+	PG_RETURN_INT64(changed);
+}
+
+/*
+  table_log_refresh_restore()
+
+  move a restore table created by table_log_restore_table() to
+  another timestamp, applying only the log entries between the
+  timestamp it was restored to and the new one
+
+  parameter:
+  - restore table
+  - new timestamp
+  return:
+    number of rows deleted, updated and inserted
+*/
+Datum table_log_refresh_restore(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr restore_descr;
+	Oid                  restore_relid;
+	char                *restore_ident;
+	char                *ext_schema;
+	char                *log_ident;
+	char                *log_pkey;
+	char                *old_timestamp;
+	char                *new_timestamp;
+	char                *watermark;
+	bool                 forward;
+	bool                 isnull;
+	List                *col_names;
+	StringInfoData       query;
+	int64                changed;
+	int                  ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_refresh_restore: missing restore table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_refresh_restore: missing timestamp");
+	}
+
+	restore_relid = PG_GETARG_OID(0);
+	restore_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+														ObjectIdGetDatum(restore_relid)));
+	new_timestamp = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		 PG_GETARG_DATUM(1))));
+	ext_schema    = do_quote_ident(get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid)));
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_refresh_restore: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * Where is the restore table now?
+	 */
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT orig_rel::oid, log_rel::oid, log_pkey, quote_literal(restored_to), "
+					 "trigger_id, restored_to <= %s::timestamptz "
+					 "FROM %s.table_log_restores WHERE restore_rel::oid = %u FOR UPDATE",
+					 new_timestamp,
+					 ext_schema,
+					 restore_relid);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	ret = SPI_exec(query.data, 0);
+
+	if (ret != SPI_OK_SELECT)
+	{
+		elog(ERROR, "could not get restore table: %s", restore_ident);
+	}
+
+	if (SPI_processed == 0)
+	{
+		elog(ERROR, "relation %s was not created by table_log_restore_table()",
+			 restore_ident);
+	}
+
+	/*
+	 * Crash recovery empties unlogged tables without removing their
+	 * registration, refreshing one would silently lose all rows
+	 * restored before.
+	 */
+	if (get_rel_persistence(restore_relid) == RELPERSISTENCE_UNLOGGED)
+	{
+		elog(ERROR, "table_log_refresh_restore: unlogged relation %s can't be refreshed",
+			 restore_ident);
+	}
+
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+																SPI_tuptable->tupdesc,
+																1, &isnull)),
+								 DatumGetObjectId(SPI_getbinval(SPI_tuptable->vals[0],
+																SPI_tuptable->tupdesc,
+																2, &isnull)));
+
+	log_pkey      = do_quote_ident(SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 3));
+	old_timestamp = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 4);
+	watermark     = SPI_getvalue(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 5);
+	forward       = DatumGetBool(SPI_getbinval(SPI_tuptable->vals[0],
+											   SPI_tuptable->tupdesc,
+											   6, &isnull));
+	log_ident     = DatumGetCString(DirectFunctionCall1(regclassout,
+														ObjectIdGetDatum(restore_descr.log_relid)));
+	col_names     = getRelationColumnNames(restore_descr.orig_relid);
+
+	if (forward && restore_descr.log_mode == TABLE_LOG_MODE_BASIC)
+	{
+		elog(ERROR, "table_log_refresh_restore: log table %s is written by table_log_basic(), "
+			 "%s can only be moved backward",
+			 log_ident, restore_ident);
+	}
+
+	if (!forward && restore_descr.log_mode == TABLE_LOG_MODE_CHAIN)
+	{
+		elog(ERROR, "table_log_refresh_restore: log table %s is written by table_log_chain(), "
+			 "%s can only be moved forward",
+			 log_ident, restore_ident);
+	}
+
+	/*
+	 * The new watermark must not be passed by entries committed
+	 * later, see table_log_restore_table().
+	 */
+	checkRefreshIsolation("table_log_refresh_restore");
+	LockRelationOid(restore_descr.orig_relid, ShareLock);
+
+	/*
+	 * Rolling forward, apply everything up to the new timestamp
+	 * the restore table doesn't contain yet. This includes entries
+	 * before the old timestamp written by transactions which hadn't
+	 * changed the table yet when it was restored, they are above the
+	 * watermark. Rolling backward, undo the entries after the new
+	 * timestamp the restore table contains.
+	 */
+	resetStringInfo(&query);
+
+	if (forward)
+	{
+		appendStringInfo(&query,
+						 "trigger_changed <= %s AND (trigger_changed > %s OR %s > %s)",
+						 new_timestamp,
+						 old_timestamp,
+						 log_pkey,
+						 watermark);
+	}
+	else
+	{
+		appendStringInfo(&query,
+						 "trigger_changed > %s AND trigger_changed <= %s AND %s <= %s",
+						 new_timestamp,
+						 old_timestamp,
+						 log_pkey,
+						 watermark);
+	}
+
+	changed = applyLogDelta(restore_ident,
+							log_ident,
+							log_pkey,
+							restore_descr.orig_pk_attr_names,
+							col_names,
+							query.data,
+							forward);
+
+	/*
+	 * Only rolling forward adds log entries to the restore table.
+	 */
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "UPDATE %s.table_log_restores SET restored_to = %s",
+					 ext_schema,
+					 new_timestamp);
+
+	if (forward)
+	{
+		appendStringInfo(&query,
+						 ", trigger_id = (SELECT COALESCE(max(%s), 0)::bigint FROM %s)",
+						 log_pkey,
+						 log_ident);
+	}
+
+	appendStringInfo(&query, " WHERE restore_rel::oid = %u", restore_relid);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_UPDATE)
+	{
+		elog(ERROR, "could not update restore table: %s", restore_ident);
+	}
+
+	SPI_finish();
+
+	elog(DEBUG2, "table_log_refresh_restore() done, " INT64_FORMAT " rows changed in %s",
+		 changed, restore_ident);
+
+	PG_RETURN_INT64(changed);
+}
+
+/*
+ * Returns a query which yields the keys to restore for
+ * table_log_restore_keys(), with one column per primary key column.
+ *
+ * keys is either an array of keys, written as for the search_pkey
+ * argument of table_log_restore_table(), or a table having columns
+ * named like the primary key columns of the original table.
+ */
+static char *getSearchKeysQuery(TableLogRestoreDescr *restore_descr,
+								Oid keys_type,
+								Datum keys)
+{
+	StringInfoData buf;
+	ListCell      *scan;
+	int            j;
+
+	initStringInfo(&buf);
+
+	if (keys_type == REGCLASSOID)
+	{
+		Oid   keys_relid = DatumGetObjectId(keys);
+		char *keys_ident;
+
+		keys_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+														 ObjectIdGetDatum(keys_relid)));
+
+		foreach(scan, restore_descr->orig_pk_attr_names)
+		{
+			if (get_attnum(keys_relid, (char *) lfirst(scan)) == InvalidAttrNumber)
+			{
+				elog(ERROR, "key table %s has no column \"%s\"",
+					 keys_ident, (char *) lfirst(scan));
+			}
+		}
+
+		appendStringInfoString(&buf, "SELECT ");
+		appendKeyColumnList(&buf, restore_descr->orig_pk_attr_names, NULL);
+		appendStringInfo(&buf, " FROM %s", keys_ident);
+	}
+	else
+	{
+		ArrayType *keys_array = DatumGetArrayTypeP(keys);
+		Datum     *elems;
+		bool      *elem_nulls;
+		char     **pk_types;
+		int        num_elems;
+		int        num_pkeys = restore_descr->orig_num_pk_attnums;
+		int        i;
+
+		deconstruct_array(keys_array, TEXTOID, -1, false, 'i',
+						  &elems, &elem_nulls, &num_elems);
+
+		if (num_elems == 0)
+		{
+			elog(ERROR, "no keys to restore");
+		}
+
+		/*
+		 * The values are cast to the types of the key columns,
+		 * otherwise they would be compared as text.
+		 */
+		pk_types = (char **) palloc(num_pkeys * sizeof(char *));
+
+		j = 0;
+		foreach(scan, restore_descr->orig_pk_attr_names)
+		{
+			Oid   typid;
+			int32 typmod;
+			Oid   collid;
+
+			get_atttypetypmodcoll(restore_descr->orig_relid,
+								  get_attnum(restore_descr->orig_relid,
+											 (char *) lfirst(scan)),
+								  &typid, &typmod, &collid);
+
+			pk_types[j++] = format_type_with_typemod(typid, typmod);
+		}
+
+		appendStringInfoString(&buf, "VALUES ");
+
+		for (i = 0; i < num_elems; i++)
+		{
+			char **pk_values;
+
+			if (elem_nulls[i])
+			{
+				elog(ERROR, "pkey cannot be NULL");
+			}
+
+			pk_values = splitPrimaryKeyString(TextDatumGetCString(elems[i]),
+											  num_pkeys);
+
+			appendStringInfoString(&buf, (i > 0) ? ", (" : "(");
+
+			for (j = 0; j < num_pkeys; j++)
+			{
+				if (j > 0)
+					appendStringInfoString(&buf, ", ");
+
+				appendStringInfo(&buf, "%s::%s",
+								 do_quote_literal(pk_values[j]),
+								 pk_types[j]);
+			}
+
+			appendStringInfoChar(&buf, ')');
+		}
+	}
+
+	return buf.data;
+}
+
+/*
+ * Returns the quoted, possibly schema qualified name of a restore
+ * table to create. The table must not exist yet.
+ */
+static char *getNewRestoreTableIdent(text *name)
+{
+	List *restore_names = textToQualifiedNameList(name);
+	char *restore_ident = NameListToQuotedString(restore_names);
+
+	if (RangeVarGetRelid(makeRangeVarFromNameList(restore_names), NoLock, true) != InvalidOid)
+	{
+		elog(ERROR, "restore table already exists: %s", restore_ident);
+	}
+
+	return restore_ident;
+}
+
+/*
+ * Returns the option of SELECT INTO creating a restore table of the
+ * kind passed to the restore functions: 0 = temporary (the default),
+ * 1 = regular and 2 = unlogged table. An unlogged table saves writing
+ * WAL for large restores, but is emptied by a crash.
+ */
+static const char *getRestoreTableOption(int not_temporarly)
+{
+	if (not_temporarly > 1)
+		return "UNLOGGED ";
+
+	return (not_temporarly > 0) ? "" : "TEMPORARY ";
+}
+
+/*
+ * Creates an index on the primary key columns of the original table
+ * on the restore table, for the key lookups of the replay and of
+ * table_log_refresh_restore(). It isn't unique, the replay doesn't
+ * check the keys either. The caller must be connected to SPI.
+ */
+static void createRestoreIndex(const char *restore_ident,
+							   List *pk_attr_names)
+{
+	StringInfoData query;
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "CREATE INDEX ON %s (", restore_ident);
+	appendKeyColumnList(&query, pk_attr_names, NULL);
+	appendStringInfoChar(&query, ')');
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_UTILITY)
+	{
+		elog(ERROR, "could not create index on restore table: %s",
+			 restore_ident);
+	}
+
+	pfree(query.data);
+}
+
+/*
+ * Describes the restore of the original table of restore_descr to
+ * the given timestamp in state, starting from wherever the estimates
+ * say it is cheapest. search_keys restricts the restore to some keys
+ * (see getSearchKeysQuery()) or is NULL, filter restricts it to the
+ * rows matching an expression (see checkRestoreFilter()) or is NULL.
+ *
+ * ext_namespace is the namespace the table_log extension lives in. The
+ * caller must be connected to SPI.
+ */
+static void setCheapestRestoreState(TableLogStateQuery *state,
+									TableLogRestoreDescr *restore_descr,
+									Datum timestamp,
+									char *search_keys,
+									char *filter,
+									Oid ext_namespace)
+{
+	TableLogRestoreColumns   *columns;
+	TableLogRestoreCandidate *cheapest;
+
+	columns = getRestoreColumns(restore_descr->orig_relid,
+								restore_descr->log_relid);
+
+	if (get_attnum(restore_descr->log_relid,
+				   restore_descr->pkey_log) == InvalidAttrNumber)
+	{
+		elog(ERROR, "could not check relation [4]: %s",
+			 DatumGetCString(DirectFunctionCall1(regclassout,
+												 ObjectIdGetDatum(restore_descr->log_relid))));
+	}
+
+	state->base_ident         = NULL;
+	state->log_ident          = DatumGetCString(DirectFunctionCall1(regclassout,
+																	ObjectIdGetDatum(restore_descr->log_relid)));
+	state->log_pkey           = do_quote_ident(restore_descr->pkey_log);
+	state->col_list           = columns->col_list;
+	state->pk_attr_names      = restore_descr->orig_pk_attr_names;
+	state->timestamp          = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																					timestamp)));
+	state->method             = 2;
+	state->log_window         = NULL;
+	state->search_pkey_values = NULL;
+	state->search_keys        = search_keys;
+	state->filter             = filter;
+	state->log_mode           = restore_descr->log_mode;
+
+	(void) getRestoreCandidates(restore_descr, state, ext_namespace, &cheapest);
+
+	state->base_ident = cheapest->base_ident;
+	state->method     = cheapest->method;
+	state->log_window = cheapest->log_window;
+
+	checkLogChain(state);
+}
+
+/*
+  table_log_restore_keys()
+
+  restore many keys of a table at once into a single restore
+  table, reading the log only once
+
+  parameter:
+  - original table
+  - logging table
+  - restore table
+  - timestamp for restoring data
+  - keys to restore, either an array of keys (each written as the
+    search_pkey argument of table_log_restore_table()) or a table
+    with the primary key columns of the original table
+  - dont create table temporarly (optional)
+    0: create restore table temporarly (default)
+    1: create restore table not temporarly
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    number of rows in the restore table
+*/
+Datum table_log_restore_keys(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr      restore_descr;
+	TableLogStateQuery        state;
+	char                     *restore_ident;
+	char                     *search_keys;
+	int                       not_temporarly = 0;
+	StringInfoData            query;
+	int64                     restored;
+	int                       ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_restore_keys: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_restore_keys: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_restore_keys: missing restore table");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_restore_keys: missing timestamp");
+	}
+	if (PG_ARGISNULL(4))
+	{
+		elog(ERROR, "table_log_restore_keys: missing keys");
+	}
+
+	if (PG_NARGS() >= 6 && !PG_ARGISNULL(5) && PG_GETARG_INT32(5) > 0)
+		not_temporarly = (PG_GETARG_INT32(5) > 1) ? 2 : 1;
+
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+	restore_descr.pkey_log = (PG_NARGS() >= 7 && !PG_ARGISNULL(6))
+		? text_to_cstring(PG_GETARG_TEXT_PP(6)) : "trigger_id";
+
+	restore_ident = getNewRestoreTableIdent(PG_GETARG_TEXT_PP(2));
+	search_keys   = getSearchKeysQuery(&restore_descr,
+									   get_fn_expr_argtype(fcinfo->flinfo, 4),
+									   PG_GETARG_DATUM(4));
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_restore_keys: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * The estimates include the filter on the keys, so for a
+	 * few keys starting from the original table is usually the
+	 * cheapest.
+	 */
+	setCheapestRestoreState(&state, &restore_descr,
+							PG_GETARG_DATUM(3),
+							search_keys,
+							NULL,
+							get_func_namespace(fcinfo->flinfo->fn_oid));
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT * INTO %sTABLE %s FROM (",
+					 getRestoreTableOption(not_temporarly),
+					 restore_ident);
+	appendRestoreStateQuery(&query, &state);
+	appendStringInfoString(&query, ") AS table_log_restore");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	ret = SPI_exec(query.data, 0);
+
+	if (ret != SPI_OK_SELINTO)
+	{
+		elog(ERROR, "could not restore data into: %s", restore_ident);
+	}
+
+	restored = SPI_processed;
+
+	SPI_finish();
+
+	elog(DEBUG2, "table_log_restore_keys() done, " INT64_FORMAT " rows restored in %s",
+		 restored, restore_ident);
+
+	PG_RETURN_INT64(restored);
+}
+
+/*
+  table_log_restore_tables()
+
+  restore several tables to the same timestamp in the past, e.g.
+  orders together with their lines and payments
+
+  All restore tables are filled by a single statement, so they are
+  read under one snapshot and are consistent with each other even
+  while the original tables are being changed.
+
+  parameter:
+  - array of original tables
+  - array of logging tables, one for each original table
+  - array of restore table names, one for each original table
+  - timestamp for restoring data
+  - dont create tables temporarly (optional)
+    0: create restore tables temporarly (default)
+    1: create restore tables not temporarly
+  - name of primary key in logging tables (optional, default trigger_id)
+  return:
+    one row for each restore table with the number of rows restored
+*/
+Datum table_log_restore_tables(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo    *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc         tupdesc;
+	Tuplestorestate  *tupstore;
+	MemoryContext     oldcontext;
+	Datum            *orig_elems;
+	Datum            *log_elems;
+	Datum            *restore_elems;
+	bool             *elem_nulls;
+	int               num_tables, num_logs, num_restores;
+	char            **restore_idents;
+	char             *log_pkey;
+	int               not_temporarly = 0;
+	StringInfoData    query;
+	StringInfoData    insert_query;
+	int               ret, i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_restore_tables: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		elog(ERROR, "table_log_restore_tables: materialize mode required, but it is not allowed in this context");
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "table_log_restore_tables: return type must be a row type");
+	}
+
+	for (i = 0; i < 4; i++)
+	{
+		if (PG_ARGISNULL(i))
+		{
+			elog(ERROR, "table_log_restore_tables: missing argument %d", i + 1);
+		}
+	}
+
+	if (PG_NARGS() >= 5 && !PG_ARGISNULL(4) && PG_GETARG_INT32(4) > 0)
+		not_temporarly = (PG_GETARG_INT32(4) > 1) ? 2 : 1;
+
+	log_pkey = (PG_NARGS() >= 6 && !PG_ARGISNULL(5))
+		? text_to_cstring(PG_GETARG_TEXT_PP(5)) : "trigger_id";
+
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(0), REGCLASSOID, sizeof(Oid), true, 'i',
+					  &orig_elems, &elem_nulls, &num_tables);
+	for (i = 0; i < num_tables; i++)
+	{
+		if (elem_nulls[i])
+			elog(ERROR, "table_log_restore_tables: original table cannot be NULL");
+	}
+
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(1), REGCLASSOID, sizeof(Oid), true, 'i',
+					  &log_elems, &elem_nulls, &num_logs);
+	for (i = 0; i < num_logs; i++)
+	{
+		if (elem_nulls[i])
+			elog(ERROR, "table_log_restore_tables: log table cannot be NULL");
+	}
+
+	deconstruct_array(PG_GETARG_ARRAYTYPE_P(2), TEXTOID, -1, false, 'i',
+					  &restore_elems, &elem_nulls, &num_restores);
+	for (i = 0; i < num_restores; i++)
+	{
+		if (elem_nulls[i])
+			elog(ERROR, "table_log_restore_tables: restore table cannot be NULL");
+	}
+
+	if (num_tables == 0 || num_logs != num_tables || num_restores != num_tables)
+	{
+		elog(ERROR, "table_log_restore_tables: need the same number of original, log and restore tables");
+	}
+
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_restore_tables: SPI_connect returned %d", ret);
+	}
+
+	/*
+	 * Create the restore tables empty and collect one data
+	 * modifying CTE for each of them, to fill all of them with
+	 * a single statement.
+	 */
+	restore_idents = (char **) palloc(num_tables * sizeof(char *));
+
+	initStringInfo(&query);
+	initStringInfo(&insert_query);
+	appendStringInfoString(&insert_query, "WITH ");
+
+	for (i = 0; i < num_tables; i++)
+	{
+		TableLogRestoreDescr restore_descr;
+		TableLogStateQuery   state;
+
+		setTableLogRestoreDescrByOid(&restore_descr,
+									 DatumGetObjectId(orig_elems[i]),
+									 DatumGetObjectId(log_elems[i]));
+		restore_descr.pkey_log = log_pkey;
+
+		restore_idents[i] = getNewRestoreTableIdent(DatumGetTextPP(restore_elems[i]));
+
+		setCheapestRestoreState(&state, &restore_descr,
+								PG_GETARG_DATUM(3),
+								NULL,
+								NULL,
+								get_func_namespace(fcinfo->flinfo->fn_oid));
+
+		resetStringInfo(&query);
+		appendStringInfo(&query, "SELECT %s INTO %sTABLE %s FROM %s LIMIT 0",
+						 state.col_list,
+						 getRestoreTableOption(not_temporarly),
+						 restore_idents[i],
+						 DatumGetCString(DirectFunctionCall1(regclassout,
+															 ObjectIdGetDatum(restore_descr.orig_relid))));
+
+		elog(DEBUG3, "query: %s", query.data);
+
+		if (SPI_exec(query.data, 0) != SPI_OK_SELINTO)
+		{
+			elog(ERROR, "could not create restore table: %s", restore_idents[i]);
+		}
+
+		appendStringInfo(&insert_query,
+						 "%stable_log_restore_%d AS (INSERT INTO %s ",
+						 (i > 0) ? ", " : "",
+						 i,
+						 restore_idents[i]);
+		appendRestoreStateQuery(&insert_query, &state);
+		appendStringInfoString(&insert_query, " RETURNING 1)");
+	}
+
+	appendStringInfoString(&insert_query, " SELECT ");
+
+	for (i = 0; i < num_tables; i++)
+	{
+		appendStringInfo(&insert_query,
+						 "%s(SELECT count(*) FROM table_log_restore_%d)",
+						 (i > 0) ? ", " : "",
+						 i);
+	}
+
+	elog(DEBUG3, "query: %s", insert_query.data);
+
+	if (SPI_exec(insert_query.data, 0) != SPI_OK_SELECT || SPI_processed != 1)
+	{
+		elog(ERROR, "could not restore data");
+	}
+
+	for (i = 0; i < num_tables; i++)
+	{
+		Datum values[2];
+		bool  nulls[2] = {false, false};
+		bool  isnull;
+
+		values[0] = CStringGetTextDatum(restore_idents[i]);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc,
+								  i + 1, &isnull);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * Checks the file name passed to table_log_export() or
+ * table_log_import() and returns it canonicalized. Only
+ * relative paths below the data directory are allowed.
+ */
+static char *getExportPath(text *path)
+{
+	char *filename = text_to_cstring(path);
+
+	if (!superuser())
+	{
+		elog(ERROR, "must be superuser to export or import log tables");
+	}
+
+	canonicalize_path(filename);
+
+	if (is_absolute_path(filename)
+		|| !path_is_relative_and_below_cwd(filename))
+	{
+		elog(ERROR, "path must be below the data directory: \"%s\"", filename);
+	}
+
+	return filename;
+}
+
+/*
+ * Writes a 32 bit integer to an export file, in network
+ * byte order.
+ */
+static void writeExportInt32(FILE *file, int32 value, const char *path)
+{
+	unsigned char buf[4];
+
+	buf[0] = (unsigned char) ((uint32) value >> 24);
+	buf[1] = (unsigned char) ((uint32) value >> 16);
+	buf[2] = (unsigned char) ((uint32) value >> 8);
+	buf[3] = (unsigned char) value;
+
+	writeExportBytes(file, (const char *) buf, 4, path);
+}
+
+/*
+ * Writes raw bytes to an export file.
+ */
+static void writeExportBytes(FILE *file, const char *data, int32 len,
+							 const char *path)
+{
+	if (len > 0 && fwrite(data, 1, len, file) != (size_t) len)
+	{
+		elog(ERROR, "could not write file \"%s\": %m", path);
+	}
+}
+
+/*
+ * Writes a string to an export file, prefixed by its length.
+ */
+static void writeExportString(FILE *file, const char *str, const char *path)
+{
+	int32 len = strlen(str);
+
+	writeExportInt32(file, len, path);
+	writeExportBytes(file, str, len, path);
+}
+
+/*
+ * Reads a 32 bit integer in network byte order from an
+ * export file.
+ */
+static int32 readExportInt32(FILE *file, const char *path)
+{
+	unsigned char buf[4];
+
+	readExportBytes(file, (char *) buf, 4, path);
+
+	return (int32) (((uint32) buf[0] << 24)
+					| ((uint32) buf[1] << 16)
+					| ((uint32) buf[2] << 8)
+					| (uint32) buf[3]);
+}
+
+/*
+ * Reads raw bytes from an export file, a short read is an error.
+ */
+static void readExportBytes(FILE *file, char *data, int32 len,
+							const char *path)
+{
+	if (len > 0 && fread(data, 1, len, file) != (size_t) len)
+	{
+		if (ferror(file))
+			elog(ERROR, "could not read file \"%s\": %m", path);
+		else
+			elog(ERROR, "unexpected end of export file \"%s\"", path);
+	}
+}
+
+/*
+ * Reads a string written by writeExportString().
+ */
+static char *readExportString(FILE *file, const char *path)
+{
+	int32  len = readExportInt32(file, path);
+	char  *str;
+
+	if (len < 0 || len > MaxAllocSize - 1)
+	{
+		elog(ERROR, "invalid export file \"%s\"", path);
+	}
+
+	str = palloc(len + 1);
+	readExportBytes(file, str, len, path);
+	str[len] = '\0';
+
+	return str;
+}
+
+/*
+  table_log_export()
+
+  write a range of a log table into a binary file below the
+  data directory, see table_log_import()
+
+  The file starts with a header describing the log table: the magic
+  TABLELOG, the format version, the name of the log table and the
+  number, names and types of its columns. Each row follows as the
+  number of columns and, for each column, the length of the value
+  (-1 for NULL) and the value in its binary send format. A length
+  of -1 in place of the number of columns ends the file.
+
+  parameter:
+  - logging table
+  - start of the range, either a log primary key or a timestamp
+    (optional, NULL exports from the beginning)
+  - end of the range, same type as the start (optional, NULL exports
+    up to the end)
+  - file name, relative to the data directory
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    number of rows exported
+*/
+Datum table_log_export(PG_FUNCTION_ARGS)
+{
+	Oid               log_relid;
+	char             *log_ident;
+	char             *log_pkey;
+	char             *range_col;
+	char             *filename;
+	char             *tmpname;
+	Oid               range_type;
+	Oid               range_out;
+	bool              range_isvarlena;
+	Relation          logRel;
+	TupleDesc         tupdesc;
+	Oid              *send_funcs;
+	int              *attnums;
+	int               natts = 0;
+	FILE             *file;
+	StringInfoData    query;
+	SPIPlanPtr        plan;
+	Portal            portal;
+	MemoryContext     rowcontext;
+	MemoryContext     oldcontext;
+	int64             exported = 0;
+	int               ret, i;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_export: missing log table");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_export: missing file name");
+	}
+
+	filename  = getExportPath(PG_GETARG_TEXT_PP(3));
+	log_relid = PG_GETARG_OID(0);
+	log_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+													ObjectIdGetDatum(log_relid)));
+	log_pkey  = do_quote_ident((PG_NARGS() >= 5 && !PG_ARGISNULL(4))
+							   ? text_to_cstring(PG_GETARG_TEXT_PP(4)) : "trigger_id");
+
+	/* a range of timestamps or of log primary keys */
+	range_type = get_fn_expr_argtype(fcinfo->flinfo, 1);
+	range_col  = (range_type == TIMESTAMPTZOID) ? "trigger_changed" : log_pkey;
+	getTypeOutputInfo(range_type, &range_out, &range_isvarlena);
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_export: SPI_connect returned %d", ret);
+	}
+
+	tmpname = psprintf("%s.tmp", filename);
+	file    = AllocateFile(tmpname, PG_BINARY_W);
+
+	if (file == NULL)
+	{
+		elog(ERROR, "could not create file \"%s\": %m", tmpname);
+	}
+
+	/*
+	 * Don't leave a partial file behind on errors, AllocateFile()
+	 * only closes it at abort.
+	 */
+	PG_TRY();
+	{
+		/*
+		 * Header: the layout of the log table.
+		 */
+	#if PG_VERSION_NUM >= 120000
+		logRel = table_open(log_relid, AccessShareLock);
+	#else
+		logRel = heap_open(log_relid, AccessShareLock);
+	#endif
+		tupdesc = RelationGetDescr(logRel);
+
+		send_funcs = (Oid *) palloc(tupdesc->natts * sizeof(Oid));
+		attnums    = (int *) palloc(tupdesc->natts * sizeof(int));
+
+		for (i = 0; i < tupdesc->natts; i++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+			bool              isvarlena;
+
+			if (attr->attisdropped)
+				continue;
+
+			getTypeBinaryOutputInfo(attr->atttypid, &send_funcs[natts], &isvarlena);
+			attnums[natts++] = i;
+		}
+
+		writeExportBytes(file, TABLE_LOG_EXPORT_MAGIC, strlen(TABLE_LOG_EXPORT_MAGIC), tmpname);
+		writeExportInt32(file, TABLE_LOG_EXPORT_VERSION, tmpname);
+		writeExportString(file, log_ident, tmpname);
+		writeExportInt32(file, natts, tmpname);
+
+		initStringInfo(&query);
+		appendStringInfoString(&query, "SELECT ");
+
+		for (i = 0; i < natts; i++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnums[i]);
+
+			writeExportString(file, NameStr(attr->attname), tmpname);
+			writeExportString(file, format_type_with_typemod(attr->atttypid, attr->atttypmod), tmpname);
+
+			if (i > 0)
+				appendStringInfoString(&query, ", ");
+			appendStringInfoString(&query, quote_identifier(NameStr(attr->attname)));
+		}
+
+	#if PG_VERSION_NUM >= 120000
+		table_close(logRel, AccessShareLock);
+	#else
+		heap_close(logRel, AccessShareLock);
+	#endif
+
+		/*
+		 * The rows, in log order.
+		 */
+		appendStringInfo(&query, " FROM %s WHERE true", log_ident);
+
+		if (!PG_ARGISNULL(1))
+		{
+			appendStringInfo(&query, " AND %s >= %s", range_col,
+							 do_quote_literal(OidOutputFunctionCall(range_out,
+																  PG_GETARG_DATUM(1))));
+		}
+		if (!PG_ARGISNULL(2))
+		{
+			appendStringInfo(&query, " AND %s <= %s", range_col,
+							 do_quote_literal(OidOutputFunctionCall(range_out,
+																  PG_GETARG_DATUM(2))));
+		}
+
+		appendStringInfo(&query, " ORDER BY %s", log_pkey);
+
+		elog(DEBUG3, "query: %s", query.data);
+
+		plan = SPI_prepare(query.data, 0, NULL);
+
+		if (plan == NULL)
+		{
+			elog(ERROR, "table_log_export: SPI_prepare returned %d", SPI_result);
+		}
+
+		portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
+
+		rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+										   "table_log export",
+										   ALLOCSET_DEFAULT_SIZES);
+
+		for (;;)
+		{
+			uint64 k;
+
+			SPI_cursor_fetch(portal, true, 1000);
+
+			if (SPI_processed == 0)
+				break;
+
+			oldcontext = MemoryContextSwitchTo(rowcontext);
+
+			for (k = 0; k < SPI_processed; k++)
+			{
+				writeExportInt32(file, natts, tmpname);
+
+				for (i = 0; i < natts; i++)
+				{
+					bool   isnull;
+					Datum  value;
+					bytea *outputbytes;
+
+					value = SPI_getbinval(SPI_tuptable->vals[k], SPI_tuptable->tupdesc,
+										  i + 1, &isnull);
+
+					if (isnull)
+					{
+						writeExportInt32(file, -1, tmpname);
+						continue;
+					}
+
+					outputbytes = OidSendFunctionCall(send_funcs[i], value);
+					writeExportInt32(file, VARSIZE(outputbytes) - VARHDRSZ, tmpname);
+					writeExportBytes(file, VARDATA(outputbytes),
+									 VARSIZE(outputbytes) - VARHDRSZ, tmpname);
+				}
+
+				exported++;
+			}
+
+			MemoryContextSwitchTo(oldcontext);
+			MemoryContextReset(rowcontext);
+
+			SPI_freetuptable(SPI_tuptable);
+		}
+
+		SPI_cursor_close(portal);
+
+		writeExportInt32(file, -1, tmpname);
+	}
+	PG_CATCH();
+	{
+		FreeFile(file);
+		unlink(tmpname);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	if (FreeFile(file) != 0)
+	{
+		int save_errno = errno;
+
+		unlink(tmpname);
+		errno = save_errno;
+		elog(ERROR, "could not write file \"%s\": %m", tmpname);
+	}
+
+	/* the file only appears once it is complete */
+	durable_rename(tmpname, filename, ERROR);
+
+	SPI_finish();
+
+	elog(DEBUG2, "table_log_export() done, " INT64_FORMAT " rows written to %s",
+		 exported, filename);
+
+	PG_RETURN_INT64(exported);
+}
+
+/*
+  table_log_import()
+
+  load a file written by table_log_export() into a log table
+
+  The columns of the log table must match the columns in the
+  header of the file, but the table can be any other log table
+  with the same layout. This allows to load a range of an archived
+  log into a scratch table and restore from there.
+
+  parameter:
+  - logging table
+  - file name, relative to the data directory
+  return:
+    number of rows imported
+*/
+Datum table_log_import(PG_FUNCTION_ARGS)
+{
+	Oid               log_relid;
+	char             *log_ident;
+	char             *filename;
+	char             *source;
+	char              magic[sizeof(TABLE_LOG_EXPORT_MAGIC)];
+	Relation          logRel;
+	TupleDesc         tupdesc;
+	Oid              *argtypes;
+	Oid              *recv_funcs;
+	Oid              *typioparams;
+	int32            *typmods;
+	Datum            *values;
+	char             *nulls;
+	int               natts = 0;
+	int32             file_natts;
+	FILE             *file;
+	StringInfoData    query;
+	StringInfoData    field;
+	SPIPlanPtr        plan;
+	MemoryContext     rowcontext;
+	MemoryContext     oldcontext;
+	int64             imported = 0;
+	int               ret, i;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_import: missing log table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_import: missing file name");
+	}
+
+	filename  = getExportPath(PG_GETARG_TEXT_PP(1));
+	log_relid = PG_GETARG_OID(0);
+	log_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+													ObjectIdGetDatum(log_relid)));
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
+	{
+		elog(ERROR, "table_log_import: SPI_connect returned %d", ret);
+	}
+
+	file = AllocateFile(filename, PG_BINARY_R);
+
+	if (file == NULL)
+	{
+		elog(ERROR, "could not open file \"%s\": %m", filename);
+	}
+
+	/*
+	 * Check the header against the layout of the log table.
+	 */
+	readExportBytes(file, magic, strlen(TABLE_LOG_EXPORT_MAGIC), filename);
+	magic[strlen(TABLE_LOG_EXPORT_MAGIC)] = '\0';
+
+	if (strcmp(magic, TABLE_LOG_EXPORT_MAGIC) != 0)
+	{
+		elog(ERROR, "\"%s\" is not a table_log export file", filename);
+	}
+
+	if (readExportInt32(file, filename) != TABLE_LOG_EXPORT_VERSION)
+	{
+		elog(ERROR, "unsupported version of export file \"%s\"", filename);
+	}
+
+	source     = readExportString(file, filename);
+	file_natts = readExportInt32(file, filename);
+
+	elog(DEBUG2, "importing rows of %s from \"%s\"", source, filename);
+
+#if PG_VERSION_NUM >= 120000
+	logRel = table_open(log_relid, RowExclusiveLock);
+#else
+	logRel = heap_open(log_relid, RowExclusiveLock);
+#endif
+	tupdesc = RelationGetDescr(logRel);
+
+	argtypes    = (Oid *) palloc(tupdesc->natts * sizeof(Oid));
+	recv_funcs  = (Oid *) palloc(tupdesc->natts * sizeof(Oid));
+	typioparams = (Oid *) palloc(tupdesc->natts * sizeof(Oid));
+	typmods     = (int32 *) palloc(tupdesc->natts * sizeof(int32));
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "INSERT INTO %s (", log_ident);
+
+	for (i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+		char             *name;
+		char             *type;
+
+		if (attr->attisdropped)
+			continue;
+
+		if (natts >= file_natts)
+		{
+			elog(ERROR, "export file \"%s\" doesn't match table %s",
+				 filename, log_ident);
+		}
+
+		name = readExportString(file, filename);
+		type = readExportString(file, filename);
+
+		if (strcmp(name, NameStr(attr->attname)) != 0
+			|| strcmp(type, format_type_with_typemod(attr->atttypid, attr->atttypmod)) != 0)
+		{
+			elog(ERROR, "export file \"%s\" doesn't match table %s",
+				 filename, log_ident);
+		}
+
+		argtypes[natts] = attr->atttypid;
+		typmods[natts]  = attr->atttypmod;
+		getTypeBinaryInputInfo(attr->atttypid, &recv_funcs[natts], &typioparams[natts]);
+
+		if (natts > 0)
+			appendStringInfoString(&query, ", ");
+		appendStringInfoString(&query, quote_identifier(name));
+
+		natts++;
+	}
+
+#if PG_VERSION_NUM >= 120000
+	table_close(logRel, NoLock);
+#else
+	heap_close(logRel, NoLock);
+#endif
+
+	if (natts != file_natts)
+	{
+		elog(ERROR, "export file \"%s\" doesn't match table %s",
+			 filename, log_ident);
+	}
+
+	appendStringInfoString(&query, ") VALUES (");
+
+	for (i = 0; i < natts; i++)
+	{
+		if (i > 0)
+			appendStringInfoString(&query, ", ");
+		appendStringInfo(&query, "$%d", i + 1);
+	}
+
+	appendStringInfoChar(&query, ')');
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	plan = SPI_prepare(query.data, natts, argtypes);
+
+	if (plan == NULL)
+	{
+		elog(ERROR, "table_log_import: SPI_prepare returned %d", SPI_result);
+	}
+
+	/*
+	 * Load the rows.
+	 */
+	values = (Datum *) palloc(natts * sizeof(Datum));
+	nulls  = (char *) palloc(natts * sizeof(char));
+
+	rowcontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "table_log import",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		int32 row_natts = readExportInt32(file, filename);
+
+		if (row_natts == -1)
+			break;
+
+		if (row_natts != natts)
+		{
+			elog(ERROR, "invalid export file \"%s\"", filename);
+		}
+
+		oldcontext = MemoryContextSwitchTo(rowcontext);
+
+		for (i = 0; i < natts; i++)
+		{
+			int32 len = readExportInt32(file, filename);
+
+			if (len == -1)
+			{
+				values[i] = (Datum) 0;
+				nulls[i]  = 'n';
+				continue;
+			}
+
+			if (len < 0 || len > MaxAllocSize - 1)
+			{
+				elog(ERROR, "invalid export file \"%s\"", filename);
+			}
+
+			initStringInfo(&field);
+			enlargeStringInfo(&field, len);
+			readExportBytes(file, field.data, len, filename);
+			field.len = len;
+			field.data[len] = '\0';
+
+			values[i] = OidReceiveFunctionCall(recv_funcs[i], &field,
+											   typioparams[i], typmods[i]);
+
+			if (field.cursor != field.len)
+			{
+				elog(ERROR, "incorrect binary data format in export file \"%s\"", filename);
+			}
+
+			nulls[i] = ' ';
+		}
+
+		MemoryContextSwitchTo(oldcontext);
+
+		if (SPI_execute_plan(plan, values, nulls, false, 0) != SPI_OK_INSERT)
+		{
+			elog(ERROR, "could not insert into relation %s", log_ident);
+		}
+
+		MemoryContextReset(rowcontext);
+
+		imported++;
+	}
+
+	FreeFile(file);
+
+	SPI_finish();
+
+	elog(DEBUG2, "table_log_import() done, " INT64_FORMAT " rows loaded into %s",
+		 imported, log_ident);
+
+	PG_RETURN_INT64(imported);
+}
+
+/*
+ * Adds the net change of a key to the result of table_log_diff(),
+ * before and after are the row images at the two timestamps or NULL
+ * if the key didn't exist. Keys without a net change are skipped.
+ */
+static void putDiffRow(Tuplestorestate *tupstore,
+					   TupleDesc tupdesc,
+					   char *key,
+					   char *before,
+					   char *after)
+{
+	Datum values[4];
+	bool  nulls[4];
+
+	if (before == NULL && after == NULL)
+		return;
+
+	if (before != NULL && after != NULL && strcmp(before, after) == 0)
+		return;
+
+	memset(nulls, 0, sizeof(nulls));
 
-	/*
-	 * Composite PK not supported atm...
-	 *
-	 * CAUTION:
-	 *
-	 * The infrastructure to support composite primary keys is there,
-	 * but the following old cold still assumes there's only one column
-	 * in the PK to consider.
-	 */
-	if (restore_descr.orig_num_pk_attnums > 1)
-		elog(ERROR, "composite primary key not supported");
+	if (before == NULL)
+		values[0] = CStringGetTextDatum("INSERT");
+	else if (after == NULL)
+		values[0] = CStringGetTextDatum("DELETE");
+	else
+		values[0] = CStringGetTextDatum("UPDATE");
 
-	/* Connect to SPI manager */
-	ret = SPI_connect();
+	values[1] = CStringGetTextDatum(key);
 
-	if (ret != SPI_OK_CONNECT)
-	{
-		elog(ERROR, "table_log_restore_table: SPI_connect returned %d", ret);
-	}
+	if (before != NULL)
+		values[2] = CStringGetTextDatum(before);
+	else
+		nulls[2] = true;
 
-	/* check original table */
-	query = makeStringInfo();
-	appendStringInfo(query,
-					 "SELECT a.attname FROM pg_class c, pg_attribute a WHERE c.oid = %s::regclass AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
-					 do_quote_literal(do_quote_ident(restore_descr.orig_relname)));
+	if (after != NULL)
+		values[3] = CStringGetTextDatum(after);
+	else
+		nulls[3] = true;
 
-	elog(DEBUG3, "query: %s", query->data);
+	tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+}
 
-	ret = SPI_exec(query->data, 0);
+/*
+  table_log_diff()
 
-	if (ret != SPI_OK_SELECT)
+  return the net changes of a table between two timestamps,
+  reading only the log entries in between
+
+  The log entries are read once, ordered by key and log order. For
+  each key, the first entry decides the row at the first timestamp
+  (an "old" tuple is its image, a "new" tuple means it didn't exist),
+  the last entry the row at the second timestamp (a "new" tuple is
+  its image, an "old" tuple means it was deleted).
+
+  parameter:
+  - original table
+  - logging table
+  - first timestamp
+  - second timestamp
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    one row for each changed key: the change (INSERT, UPDATE or
+    DELETE), the key and the row before and after the change, written
+    as row literals of the original table
+*/
+Datum table_log_diff(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr    restore_descr;
+	TableLogRestoreColumns *columns;
+	ReturnSetInfo          *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc               tupdesc;
+	Tuplestorestate        *tupstore;
+	MemoryContext           oldcontext;
+	MemoryContext           keycontext;
+	StringInfoData          query;
+	SPIPlanPtr              plan;
+	Portal                  portal;
+	char                   *log_ident;
+	char                   *log_pkey;
+	char                   *window;
+	char                   *cur_key = NULL;
+	char                   *before = NULL;
+	char                   *after = NULL;
+	int                     ret;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
 	{
-		elog(ERROR, "could not check relation: \"%s\"",
-			 restore_descr.orig_relname);
+		elog(ERROR, "table_log_diff: set-valued function called in context that cannot accept a set");
 	}
-
-	if (SPI_processed <= 0)
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
 	{
-		elog(ERROR, "could not check relation: \"%s\"",
-			 restore_descr.orig_relname);
+		elog(ERROR, "table_log_diff: materialize mode required, but it is not allowed in this context");
 	}
-
-	/* check log table */
-	if (restore_descr.log_relid == InvalidOid)
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 	{
-		elog(ERROR, "log table \"%s\" does not exist",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "table_log_diff: return type must be a row type");
 	}
 
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname \
-                      FROM pg_class c, pg_attribute a \
-                      WHERE c.oid = %u \
-                            AND c.relkind IN ('v', 'r') \
-                            AND a.attnum > 0 \
-                            AND a.attrelid = c.oid	\
-                            ORDER BY a.attnum",
-					 restore_descr.log_relid);
-
-	elog(DEBUG3, "query: %s", query->data);
-
-	ret = SPI_exec(query->data, 0);
-
-	if (ret != SPI_OK_SELECT)
+	if (PG_ARGISNULL(0))
 	{
-		elog(ERROR, "could not check relation [1]: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "table_log_diff: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_diff: missing log table");
+	}
+	if (PG_ARGISNULL(2) || PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_diff: missing timestamp");
 	}
 
-	if (SPI_processed <= 0)
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+
+	/* both images of each change are needed */
+	if (restore_descr.log_mode != TABLE_LOG_MODE_FULL)
 	{
-		elog(ERROR, "could not check relation [2]: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "table_log_diff: log table of \"%s\" is not written by table_log()",
+			 restore_descr.orig_relname);
 	}
 
-	table_log_columns = SPI_processed;
+	columns   = getRestoreColumns(restore_descr.orig_relid,
+								  restore_descr.log_relid);
+	log_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+													ObjectIdGetDatum(restore_descr.log_relid)));
+	log_pkey  = do_quote_ident((PG_NARGS() >= 5 && !PG_ARGISNULL(4))
+							   ? text_to_cstring(PG_GETARG_TEXT_PP(4)) : "trigger_id");
 
-	/* check pkey in log table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname \
-                      FROM pg_class c, pg_attribute a \
-                      WHERE c.oid=%u AND c.relkind IN ('v', 'r') \
-                            AND a.attname=%s \
-                            AND a.attnum > 0 \
-                            AND a.attrelid = c.oid",
-					 restore_descr.log_relid,
-					 do_quote_literal(restore_descr.pkey_log));
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
 
-	elog(DEBUG3, "query: %s", query->data);
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
 
-	ret = SPI_exec(query->data, 0);
+	ret = SPI_connect();
 
-	if (ret != SPI_OK_SELECT)
+	if (ret != SPI_OK_CONNECT)
 	{
-		elog(ERROR, "could not check relation [3]: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "table_log_diff: SPI_connect returned %d", ret);
 	}
 
-	if (SPI_processed == 0)
+	window = psprintf("trigger_changed > %s AND trigger_changed <= %s",
+					  do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		   PG_GETARG_DATUM(2)))),
+					  do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		   PG_GETARG_DATUM(3)))));
+
+	/* the rows removed by a TRUNCATE aren't in the log */
+	if (logHasTruncate(log_ident, restore_descr.orig_pk_attr_names, window))
 	{
-		elog(ERROR, "could not check relation [4]: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "table_log_diff: log table %s contains a TRUNCATE between the timestamps",
+			 log_ident);
+	}
+
+	/*
+	 * A single column key is returned as it is, a composite key
+	 * as a row literal, as expected by the other functions.
+	 */
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+						   (restore_descr.orig_num_pk_attnums > 1) ? "SELECT ROW(" : "SELECT (");
+	appendKeyColumnList(&query, restore_descr.orig_pk_attr_names, NULL);
+	appendStringInfo(&query,
+					 ")::text, trigger_tuple, ROW(%s)::text FROM %s WHERE %s ORDER BY ",
+					 columns->col_list,
+					 log_ident,
+					 window);
+	appendKeyColumnList(&query, restore_descr.orig_pk_attr_names, NULL);
+	appendStringInfo(&query, ", %s", log_pkey);
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	plan = SPI_prepare(query.data, 0, NULL);
+
+	if (plan == NULL)
+	{
+		elog(ERROR, "table_log_diff: SPI_prepare returned %d", SPI_result);
 	}
 
-	elog(DEBUG3, "log table: OK (%i columns)", table_log_columns);
+	portal = SPI_cursor_open(NULL, plan, NULL, NULL, true);
 
-	resetStringInfo(query);
-	if (restore_descr.use_schema_restore)
+	/* holds the images of the current key */
+	keycontext = AllocSetContextCreate(CurrentMemoryContext,
+									   "table_log diff",
+									   ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
 	{
-		appendStringInfo(query,
-						 "SELECT pg_attribute.attname AS a \
-                          FROM pg_class, pg_attribute, pg_namespace \
-                          WHERE pg_class.relname=%s					\
-                             AND pg_attribute.attnum > 0			   \
-                             AND pg_attribute.attrelid=pg_class.oid \
-                             AND pg_namespace.nspname = %s \
-					         AND pg_namespace.oid = pg_class.relnamespace",
-						 do_quote_literal(restore_descr.ident_restore.schema),
-						 do_quote_literal(restore_descr.ident_restore.relname));
+		uint64 k;
+
+		SPI_cursor_fetch(portal, true, 1000);
+
+		if (SPI_processed == 0)
+			break;
+
+		for (k = 0; k < SPI_processed; k++)
+		{
+			HeapTuple tuple  = SPI_tuptable->vals[k];
+			char     *key    = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 1);
+			char     *mode   = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 2);
+			char     *image  = SPI_getvalue(tuple, SPI_tuptable->tupdesc, 3);
+			bool      is_new = (strcmp(mode, "new") == 0);
+
+			if (cur_key == NULL || strcmp(cur_key, key) != 0)
+			{
+				/* the previous key is complete */
+				if (cur_key != NULL)
+				{
+					oldcontext = MemoryContextSwitchTo(keycontext);
+					putDiffRow(tupstore, tupdesc, cur_key, before, after);
+					MemoryContextSwitchTo(oldcontext);
+				}
+
+				MemoryContextReset(keycontext);
+
+				cur_key = MemoryContextStrdup(keycontext, key);
+				before  = is_new ? NULL : MemoryContextStrdup(keycontext, image);
+			}
+
+			after = is_new ? MemoryContextStrdup(keycontext, image) : NULL;
+
+			pfree(key);
+			pfree(mode);
+			pfree(image);
+		}
 
+		SPI_freetuptable(SPI_tuptable);
 	}
-	else
+
+	if (cur_key != NULL)
+		putDiffRow(tupstore, tupdesc, cur_key, before, after);
+
+	SPI_cursor_close(portal);
+	SPI_finish();
+
+	return (Datum) 0;
+}
+
+/*
+ * Checks the filter passed to table_log_restore_where() and returns
+ * it. The filter is pasted into the restore queries, so it must be
+ * a single expression and nothing else: parsed as the only target
+ * of a SELECT, it must not have spilled into any other clause.
+ */
+static char *checkRestoreFilter(text *filter)
+{
+	char       *expr = text_to_cstring(filter);
+	List       *parsetree;
+	SelectStmt *stmt;
+
+	parsetree = pg_parse_query(psprintf("SELECT (%s)", expr));
+
+	if (list_length(parsetree) != 1)
+		elog(ERROR, "filter is not a single expression: %s", expr);
+
+#if PG_VERSION_NUM >= 100000
+	stmt = (SelectStmt *) ((RawStmt *) linitial(parsetree))->stmt;
+#else
+	stmt = (SelectStmt *) linitial(parsetree);
+#endif
+
+	if (!IsA(stmt, SelectStmt) ||
+		stmt->op != SETOP_NONE ||
+		list_length(stmt->targetList) != 1 ||
+		((ResTarget *) linitial(stmt->targetList))->name != NULL ||
+		stmt->distinctClause != NIL ||
+		stmt->intoClause != NULL ||
+		stmt->fromClause != NIL ||
+		stmt->whereClause != NULL ||
+		stmt->groupClause != NIL ||
+		stmt->havingClause != NULL ||
+		stmt->windowClause != NIL ||
+		stmt->valuesLists != NIL ||
+		stmt->sortClause != NIL ||
+		stmt->limitOffset != NULL ||
+		stmt->limitCount != NULL ||
+		stmt->lockingClause != NIL ||
+		stmt->withClause != NULL)
 	{
-		appendStringInfo(query,
-						 "SELECT pg_attribute.attname AS a \
-                          FROM pg_class, pg_attribute \
-                          WHERE pg_class.relname=%s					\
-                             AND pg_attribute.attnum > 0			   \
-                             AND pg_attribute.attrelid=pg_class.oid",
-						 do_quote_literal(restore_descr.relname_restore));
+		elog(ERROR, "filter is not a single expression: %s", expr);
 	}
 
-	elog(DEBUG3, "query: %s", query->data);
+	return expr;
+}
 
-	ret = SPI_exec(query->data, 0);
+/*
+  table_log_restore_where()
 
-	if (ret != SPI_OK_SELECT)
+  restore the rows of a table matching an expression, e.g. all
+  rows of one tenant
+
+  The expression is pushed into the scan of the log, so only keys
+  with a matching log entry are replayed, and into the copy of the
+  base. With indexes on the filtered columns of the original and the
+  log table the restore is proportional to the history of the
+  matching rows. A row is restored if it matches the expression at
+  the timestamp, no matter if it did before or afterwards.
+
+  parameter:
+  - original table
+  - logging table
+  - restore table
+  - timestamp for restoring data
+  - filter, an expression on the columns of the original table
+  - dont create table temporarly (optional)
+    0: create restore table temporarly (default)
+    1: create restore table not temporarly
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    number of rows in the restore table
+*/
+Datum table_log_restore_where(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr      restore_descr;
+	TableLogStateQuery        state;
+	char                     *restore_ident;
+	char                     *filter;
+	int                       not_temporarly = 0;
+	StringInfoData            query;
+	int64                     restored;
+	int                       ret;
+
+	if (PG_ARGISNULL(0))
 	{
-		elog(ERROR, "could not check relation: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, restore));
+		elog(ERROR, "table_log_restore_where: missing original table");
 	}
-
-	if (SPI_processed > 0)
+	if (PG_ARGISNULL(1))
 	{
-		elog(ERROR, "restore table already exists: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, restore));
+		elog(ERROR, "table_log_restore_where: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_restore_where: missing restore table");
+	}
+	if (PG_ARGISNULL(3))
+	{
+		elog(ERROR, "table_log_restore_where: missing timestamp");
+	}
+	if (PG_ARGISNULL(4))
+	{
+		elog(ERROR, "table_log_restore_where: missing filter");
 	}
 
-	elog(DEBUG2, "restore table: OK (doesn't exists)");
+	if (PG_NARGS() >= 6 && !PG_ARGISNULL(5) && PG_GETARG_INT32(5) > 0)
+		not_temporarly = (PG_GETARG_INT32(5) > 1) ? 2 : 1;
 
-	/* now get all columns from original table */
-	resetStringInfo(query);
-	appendStringInfo(query,
-					 "SELECT a.attname, format_type(a.atttypid, a.atttypmod), a.attnum \
-                      FROM pg_class c, pg_attribute a \
-                      WHERE c.oid = %s::regclass AND a.attnum > 0 AND a.attrelid = c.oid ORDER BY a.attnum",
-					 do_quote_literal(do_quote_ident(restore_descr.orig_relname)));
+	filter = checkRestoreFilter(PG_GETARG_TEXT_PP(4));
 
-	elog(DEBUG3, "query: %s", query->data);
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+	restore_descr.pkey_log = (PG_NARGS() >= 7 && !PG_ARGISNULL(6))
+		? text_to_cstring(PG_GETARG_TEXT_PP(6)) : "trigger_id";
 
-	ret = SPI_exec(query->data, 0);
+	restore_ident = getNewRestoreTableIdent(PG_GETARG_TEXT_PP(2));
 
-	if (ret != SPI_OK_SELECT)
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
 	{
-		elog(ERROR, "could not get columns from relation: \"%s\"",
-			 restore_descr.orig_relname);
+		elog(ERROR, "table_log_restore_where: SPI_connect returned %d", ret);
 	}
 
-	if (SPI_processed == 0)
+	setCheapestRestoreState(&state, &restore_descr,
+							PG_GETARG_DATUM(3),
+							NULL,
+							filter,
+							get_func_namespace(fcinfo->flinfo->fn_oid));
+
+	initStringInfo(&query);
+	appendStringInfo(&query, "SELECT * INTO %sTABLE %s FROM (",
+					 getRestoreTableOption(not_temporarly),
+					 restore_ident);
+	appendRestoreStateQuery(&query, &state);
+	appendStringInfoString(&query, ") AS table_log_restore");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	ret = SPI_exec(query.data, 0);
+
+	if (ret != SPI_OK_SELINTO)
 	{
-		elog(ERROR, "could not check relation: \"%s\"",
-			 restore_descr.orig_relname);
+		elog(ERROR, "could not restore data into: %s", restore_ident);
 	}
 
-	results = SPI_processed;
+	restored = SPI_processed;
 
-	/* store number columns for later */
-	number_columns = SPI_processed;
+	SPI_finish();
 
-	elog(DEBUG2, "number columns: %i", results);
+	elog(DEBUG2, "table_log_restore_where() done, " INT64_FORMAT " rows restored in %s",
+		 restored, restore_ident);
 
-	for (i = 0; i < results; i++)
-	{
-		/* the column name */
-		tmp = SPI_getvalue(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1);
+	PG_RETURN_INT64(restored);
+}
 
-		/* now check, if this is the pkey */
-		if (strcmp((const char *)tmp,
-				   (const char *)list_nth(restore_descr.orig_pk_attr_names, 0)) == 0)
-		{
-			/* remember the (real) number */
-			col_pkey = i + 1;
-		}
+/*
+  table_log_compact()
+
+  replace the history of a log table up to a horizon with a baseline:
+  one INSERT entry per key which existed at the horizon, holding its
+  image at that time
+
+  The baseline entry of a key is its deciding entry at the horizon
+  (see appendRestoreStateQuery()), so it keeps its place in the log
+  order. All other entries up to the horizon are deleted, including
+  TRUNCATE markers and the entries voided by them. The deciding entry
+  of a deleted key is kept as DELETE entry if the key has a later
+  entry before it in the log order, which can happen with concurrent
+  transactions. The remaining entries are stamped with the horizon,
+  so restores to any timestamp from the horizon on give the same
+  result as before. Snapshots taken and restore tables restored
+  before the horizon can't be used afterwards, they are dropped and
+  unregistered.
+
+  parameter:
+  - original table
+  - logging table
+  - horizon
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    number of log entries deleted
+*/
+Datum table_log_compact(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr restore_descr;
+	Oid                  ext_namespace;
+	char                *ext_schema;
+	char                *log_ident;
+	char                *log_pkey;
+	char                *horizon;
+	List                *pk_attr_names;
+	StringInfoData       query;
+	int64                deleted;
+	int                  ret;
+
+	if (PG_ARGISNULL(0))
+	{
+		elog(ERROR, "table_log_compact: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_compact: missing log table");
+	}
+	if (PG_ARGISNULL(2))
+	{
+		elog(ERROR, "table_log_compact: missing horizon");
 	}
 
-	/* check if we have found the pkey */
-	if (col_pkey == 0)
+	/* later transactions could still log changes before the horizon */
+	if (PG_GETARG_TIMESTAMPTZ(2) > GetCurrentTransactionStartTimestamp())
 	{
-		elog(ERROR, "cannot find pkey (%s) in table \"%s\"",
-			 (char *)list_nth(restore_descr.orig_pk_attr_names, 0),
-			 restore_descr.orig_relname);
+		elog(ERROR, "table_log_compact: horizon is in the future");
 	}
 
-	/* allocate memory for string */
-	col_query = makeStringInfo();
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
 
-	for (i = 0; i < results; i++)
+	/* the baseline needs the image of each key at the horizon */
+	if (restore_descr.log_mode == TABLE_LOG_MODE_BASIC)
 	{
-		if (i > 0)
-			appendStringInfo(col_query, ", ");
+		elog(ERROR, "table_log_compact: log table of \"%s\" is written by table_log_basic(), "
+			 "which has no new images",
+			 restore_descr.orig_relname);
+	}
 
-		appendStringInfo(col_query, "%s",
-						 do_quote_ident(SPI_getvalue(SPI_tuptable->vals[i],
-													 SPI_tuptable->tupdesc, 1)));
+	/* in partition mode the log table is a view over the partitions */
+	if (get_rel_relkind(restore_descr.log_relid) != RELKIND_RELATION)
+	{
+		elog(ERROR, "table_log_compact: %s is not a table",
+			 DatumGetCString(DirectFunctionCall1(regclassout,
+												 ObjectIdGetDatum(restore_descr.log_relid))));
 	}
 
-	/* create restore table */
-	elog(DEBUG2, "string for columns: %s", col_query->data);
-	elog(DEBUG2, "create restore table: %s",
-		 RESTORE_TABLE_IDENT(restore_descr, restore));
-	resetStringInfo(query);
-	appendStringInfo(query, "SELECT * INTO ");
+	restore_descr.pkey_log = (PG_NARGS() >= 4 && !PG_ARGISNULL(3))
+		? text_to_cstring(PG_GETARG_TEXT_PP(3)) : "trigger_id";
 
-	/* per default create a temporary table */
-	if (not_temporarly == 0)
+	if (get_attnum(restore_descr.log_relid,
+				   restore_descr.pkey_log) == InvalidAttrNumber)
 	{
-		appendStringInfo(query, "TEMPORARY ");
+		elog(ERROR, "table_log_compact: log table has no column \"%s\"",
+			 restore_descr.pkey_log);
 	}
 
-	/* from which table? */
-	appendStringInfo(query, "TABLE %s FROM %s ",
-					 RESTORE_TABLE_IDENT(restore_descr, restore),
-					 quote_identifier(restore_descr.orig_relname));
+	ext_namespace = get_func_namespace(fcinfo->flinfo->fn_oid);
+	ext_schema    = do_quote_ident(get_namespace_name(ext_namespace));
+	log_ident     = DatumGetCString(DirectFunctionCall1(regclassout,
+														ObjectIdGetDatum(restore_descr.log_relid)));
+	log_pkey      = do_quote_ident(restore_descr.pkey_log);
+	horizon       = do_quote_literal(DatumGetCString(DirectFunctionCall1(timestamptz_out,
+																		 PG_GETARG_DATUM(2))));
+	pk_attr_names = restore_descr.orig_pk_attr_names;
 
-	if (need_search_pkey == 1)
+	/*
+	 * Wait for running changes of the original table, as
+	 * table_log_snapshot() does. Transactions starting afterwards
+	 * log their changes after the horizon.
+	 */
+	LockRelationOid(restore_descr.orig_relid, ShareLock);
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
 	{
-		/* only extract a specific key */
-		appendStringInfo(query, "WHERE %s = %s ",
-						 do_quote_ident(list_nth(restore_descr.orig_pk_attr_names, 0)),
-						 do_quote_literal(search_pkey));
+		elog(ERROR, "table_log_compact: SPI_connect returned %d", ret);
 	}
 
-	if (method == 0)
+	/*
+	 * Delete everything up to the horizon except the deciding
+	 * entries which are needed.
+	 */
+	initStringInfo(&query);
+	appendStringInfoString(&query,
+						   "WITH table_log_deciding AS (SELECT DISTINCT ON (");
+	appendKeyColumnList(&query, pk_attr_names, NULL);
+	appendStringInfo(&query, ") %s AS table_log_id, trigger_tuple AS table_log_tuple, ",
+					 log_pkey);
+	appendKeyColumnList(&query, pk_attr_names, NULL);
+	appendStringInfo(&query,
+					 " FROM %s WHERE trigger_changed <= %s "
+					 "AND (%s > (SELECT max(table_log_truncate.%s) FROM %s AS table_log_truncate "
+					 "WHERE table_log_truncate.trigger_changed <= %s AND ",
+					 log_ident,
+					 horizon,
+					 log_pkey,
+					 log_pkey,
+					 log_ident,
+					 horizon);
+	appendTruncateMarker(&query, pk_attr_names, "table_log_truncate");
+	appendStringInfoString(&query, ")) IS NOT FALSE ORDER BY ");
+	appendKeyColumnList(&query, pk_attr_names, NULL);
+	appendStringInfo(&query,
+					 ", %s DESC) "
+					 "DELETE FROM %s AS table_log_old WHERE table_log_old.trigger_changed <= %s "
+					 "AND NOT EXISTS (SELECT 1 FROM table_log_deciding AS d "
+					 "WHERE d.table_log_id = table_log_old.%s "
+					 "AND (d.table_log_tuple = 'new' "
+					 "OR EXISTS (SELECT 1 FROM %s AS table_log_newer "
+					 "WHERE table_log_newer.trigger_changed > %s "
+					 "AND table_log_newer.%s < d.table_log_id AND (",
+					 log_pkey,
+					 log_ident,
+					 horizon,
+					 log_pkey,
+					 log_ident,
+					 horizon,
+					 log_pkey);
+	appendKeyColumnList(&query, pk_attr_names, "table_log_newer");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, pk_attr_names, "d");
+	appendStringInfoString(&query, "))))");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_DELETE)
 	{
-		/* restore from begin (blank table) */
-		appendStringInfo(query, "LIMIT 0");
+		elog(ERROR, "could not compact log table %s", log_ident);
 	}
 
-	elog(DEBUG3, "query: %s", query->data);
+	deleted = SPI_processed;
 
-	ret = SPI_exec(query->data, 0);
+	/* the remaining entries up to the horizon are the baseline */
+	resetStringInfo(&query);
+	appendStringInfo(&query,
+					 "UPDATE %s SET trigger_changed = %s, "
+					 "trigger_mode = CASE WHEN trigger_tuple = 'new' THEN 'INSERT' ELSE 'DELETE' END "
+					 "WHERE trigger_changed <= %s",
+					 log_ident,
+					 horizon,
+					 horizon);
 
-	if (ret != SPI_OK_SELINTO)
+	elog(DEBUG3, "query: %s", query.data);
+
+	if (SPI_exec(query.data, 0) != SPI_OK_UPDATE)
 	{
-		elog(ERROR, "could not check relation: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, restore));
+		elog(ERROR, "could not compact log table %s", log_ident);
 	}
 
-	/* get timestamp as string */
-	timestamp_string = DatumGetCString(DirectFunctionCall1(timestamptz_out, timestamp));
+	/*
+	 * Snapshots and restore tables before the horizon would be
+	 * rolled forward over entries which are gone now.
+	 */
+	if (get_relname_relid("table_log_snapshots", ext_namespace) != InvalidOid)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query,
+						 "SELECT %s.table_log_drop_snapshot(s.snapshot_rel) "
+						 "FROM %s.table_log_snapshots s "
+						 "WHERE s.orig_rel::oid = %u AND s.log_rel::oid = %u AND s.trigger_changed < %s "
+						 "AND EXISTS (SELECT 1 FROM pg_catalog.pg_class c WHERE c.oid = s.snapshot_rel::oid)",
+						 ext_schema,
+						 ext_schema,
+						 restore_descr.orig_relid,
+						 restore_descr.log_relid,
+						 horizon);
+
+		elog(DEBUG3, "query: %s", query.data);
+
+		if (SPI_exec(query.data, 0) != SPI_OK_SELECT)
+		{
+			elog(ERROR, "could not drop snapshots of relation \"%s\"",
+				 restore_descr.orig_relname);
+		}
+	}
 
-	if (method == 0)
-		elog(DEBUG2, "need logs from start to timestamp: %s", timestamp_string);
-	else
-		elog(DEBUG2, "need logs from end to timestamp: %s", timestamp_string);
+	if (get_relname_relid("table_log_restores", ext_namespace) != InvalidOid)
+	{
+		resetStringInfo(&query);
+		appendStringInfo(&query,
+						 "DELETE FROM %s.table_log_restores r "
+						 "WHERE r.log_rel::oid = %u AND r.restored_to < %s",
+						 ext_schema,
+						 restore_descr.log_relid,
+						 horizon);
 
-	/* now build query for getting logs */
-	elog(DEBUG2, "build query for getting logs");
+		elog(DEBUG3, "query: %s", query.data);
 
-	/* allocate memory for string and build query */
-	d_query = makeStringInfo();
+		if (SPI_exec(query.data, 0) != SPI_OK_DELETE)
+		{
+			elog(ERROR, "could not clean up table_log_restores");
+		}
+	}
 
-	elog(DEBUG2, "using log table %s",
-		 RESTORE_TABLE_IDENT(restore_descr, log));
+	pfree(query.data);
 
-	appendStringInfo(d_query,
-					 "SELECT %s, trigger_mode, trigger_tuple, trigger_changed FROM %s WHERE ",
-					 col_query->data,
-					 RESTORE_TABLE_IDENT(restore_descr, log));
+	SPI_finish();
 
-	if (method == 0)
+	elog(DEBUG2, "table_log_compact() done, " INT64_FORMAT " log entries deleted from %s",
+		 deleted, log_ident);
+
+	PG_RETURN_INT64(deleted);
+}
+
+/*
+  table_log_verify()
+
+  check that the log still reconstructs the original table, e.g.
+  after changes with the trigger disabled or manual edits of the log
+
+  The rows of the table as replayed from the whole log (see
+  appendRestoreStateQuery()) and the current rows are reduced to a
+  hash per key and joined by key in a single query, without creating
+  a restore table. With table_log.restore_parallel_workers set, the
+  planner may use that many parallel workers for it.
+
+  parameter:
+  - original table
+  - logging table
+  - name of primary key in logging table (optional, default trigger_id)
+  return:
+    one row for each mismatching key: the key and the problem, one of
+    "missing" (the key is in the log, but not in the table), "unlogged"
+    (the key is in the table, but not in the log) and "different" (the
+    row differs from the logged one)
+*/
+Datum table_log_verify(PG_FUNCTION_ARGS)
+{
+	TableLogRestoreDescr    restore_descr;
+	TableLogRestoreColumns *columns;
+	TableLogStateQuery      state;
+	ReturnSetInfo          *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc               tupdesc;
+	Tuplestorestate        *tupstore;
+	MemoryContext           oldcontext;
+	StringInfoData          query;
+	const char             *key_start;
+	char                   *orig_ident;
+	int                     save_nestlevel = 0;
+	uint64                  k;
+	int                     ret;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_verify: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
 	{
-		/* from start to timestamp */
-		appendStringInfo(d_query, "trigger_changed <= %s",
-						 do_quote_literal(timestamp_string));
+		elog(ERROR, "table_log_verify: materialize mode required, but it is not allowed in this context");
 	}
-	else
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
 	{
-		/* from now() backwards to timestamp */
-		appendStringInfo(d_query, "trigger_changed >= %s ",
-						 do_quote_literal(timestamp_string));
+		elog(ERROR, "table_log_verify: return type must be a row type");
 	}
 
-	if (need_search_pkey == 1)
+	if (PG_ARGISNULL(0))
 	{
-		appendStringInfo(d_query, "AND %s = %s ",
-						 do_quote_ident(list_nth(restore_descr.orig_pk_attr_names, 0)),
-						 do_quote_literal(search_pkey));
+		elog(ERROR, "table_log_verify: missing original table");
+	}
+	if (PG_ARGISNULL(1))
+	{
+		elog(ERROR, "table_log_verify: missing log table");
 	}
 
-	if (method == 0)
+	setTableLogRestoreDescrByOid(&restore_descr,
+								 PG_GETARG_OID(0),
+								 PG_GETARG_OID(1));
+
+	/* replaying the log needs the new images */
+	if (restore_descr.log_mode == TABLE_LOG_MODE_BASIC)
 	{
-		appendStringInfo(d_query, "ORDER BY %s ASC",
-						 do_quote_ident(restore_descr.pkey_log));
+		elog(ERROR, "table_log_verify: log table of \"%s\" is written by table_log_basic(), "
+			 "which has no new images",
+			 restore_descr.orig_relname);
 	}
-	else
+
+	restore_descr.pkey_log = (PG_NARGS() >= 3 && !PG_ARGISNULL(2))
+		? text_to_cstring(PG_GETARG_TEXT_PP(2)) : "trigger_id";
+
+	columns    = getRestoreColumns(restore_descr.orig_relid,
+								   restore_descr.log_relid);
+	orig_ident = DatumGetCString(DirectFunctionCall1(regclassout,
+													 ObjectIdGetDatum(restore_descr.orig_relid)));
+
+	/* the whole log, without a base */
+	state.base_ident         = NULL;
+	state.log_ident          = DatumGetCString(DirectFunctionCall1(regclassout,
+																   ObjectIdGetDatum(restore_descr.log_relid)));
+	state.log_pkey           = do_quote_ident(restore_descr.pkey_log);
+	state.col_list           = columns->col_list;
+	state.pk_attr_names      = restore_descr.orig_pk_attr_names;
+	state.timestamp          = do_quote_literal("infinity");
+	state.method             = 0;
+	state.log_window         = NULL;
+	state.search_pkey_values = NULL;
+	state.search_keys        = NULL;
+	state.filter             = NULL;
+	state.log_mode           = restore_descr.log_mode;
+
+	/*
+	 * A single column key is returned as it is, a composite key
+	 * as a row literal, as expected by the other functions.
+	 */
+	key_start = (restore_descr.orig_num_pk_attnums > 1) ? "ROW(" : "(";
+
+	initStringInfo(&query);
+	appendStringInfo(&query,
+					 "SELECT CASE WHEN l.table_log_hash IS NULL THEN %s",
+					 key_start);
+	appendKeyColumnList(&query, state.pk_attr_names, "t");
+	appendStringInfo(&query, ")::text ELSE %s", key_start);
+	appendKeyColumnList(&query, state.pk_attr_names, "l");
+	appendStringInfoString(&query,
+						   ")::text END, "
+						   "CASE WHEN t.table_log_hash IS NULL THEN 'missing' "
+						   "WHEN l.table_log_hash IS NULL THEN 'unlogged' "
+						   "ELSE 'different' END "
+						   "FROM (SELECT ");
+	appendKeyColumnList(&query, state.pk_attr_names, NULL);
+	appendStringInfo(&query,
+					 ", md5(ROW(%s)::text) AS table_log_hash FROM (",
+					 state.col_list);
+	appendRestoreStateQuery(&query, &state);
+	appendStringInfoString(&query, ") AS table_log_state) AS l FULL JOIN (SELECT ");
+	appendKeyColumnList(&query, state.pk_attr_names, NULL);
+	appendStringInfo(&query,
+					 ", md5(ROW(%s)::text) AS table_log_hash FROM %s) AS t ON (",
+					 state.col_list,
+					 orig_ident);
+	appendKeyColumnList(&query, state.pk_attr_names, "l");
+	appendStringInfoString(&query, ") = (");
+	appendKeyColumnList(&query, state.pk_attr_names, "t");
+	appendStringInfoString(&query,
+						   ") WHERE l.table_log_hash IS DISTINCT FROM t.table_log_hash "
+						   "ORDER BY 1");
+
+	elog(DEBUG3, "query: %s", query.data);
+
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
+
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
+
+	ret = SPI_connect();
+
+	if (ret != SPI_OK_CONNECT)
 	{
-		appendStringInfo(d_query, "ORDER BY %s DESC",
-						 do_quote_ident(restore_descr.pkey_log));
+		elog(ERROR, "table_log_verify: SPI_connect returned %d", ret);
 	}
 
-	elog(DEBUG3, "query: %s", d_query->data);
+	/*
+	 * Only the mismatches are returned, so the query is executed
+	 * at once instead of through a cursor, which would rule out
+	 * parallel workers.
+	 */
+	if (tableLogRestoreParallelWorkers > 0)
+		save_nestlevel = setRestoreParallelWorkers(tableLogRestoreParallelWorkers);
 
-	ret = SPI_exec(d_query->data, 0);
+	ret = SPI_execute(query.data, true, 0);
 
 	if (ret != SPI_OK_SELECT)
 	{
-		elog(ERROR, "could not get log data from table: %s",
-			 RESTORE_TABLE_IDENT(restore_descr, log));
+		elog(ERROR, "could not verify log table %s", state.log_ident);
 	}
 
-	results = SPI_processed;
-	/* save results */
-	spi_tuptable = SPI_tuptable;
+	if (tableLogRestoreParallelWorkers > 0)
+		AtEOXact_GUC(true, save_nestlevel);
 
-	/* go through all results */
-	for (i = 0; i < results; i++)
+	for (k = 0; k < SPI_processed; k++)
 	{
+		Datum values[2];
+		bool  nulls[2];
 
-		/* get tuple data */
-		trigger_mode = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 1);
-		trigger_tuple = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 2);
-		trigger_changed = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, number_columns + 3);
+		values[0] = SPI_getbinval(SPI_tuptable->vals[k], SPI_tuptable->tupdesc, 1, &nulls[0]);
+		values[1] = SPI_getbinval(SPI_tuptable->vals[k], SPI_tuptable->tupdesc, 2, &nulls[1]);
 
-		/* check for update tuples we doesnt need */
-		if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-		{
-			if (method == 0 && strcmp((const char *)trigger_tuple, (const char *)"old") == 0)
-			{
-				/* we need the old value of the pkey for the update */
-				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
-				elog(DEBUG2, "tuple old pkey: %s", old_pkey_string);
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
 
-				/* then skip this tuple */
-				continue;
-			}
+	elog(DEBUG2, "table_log_verify() done, " UINT64_FORMAT " mismatching keys in %s",
+		 SPI_processed, orig_ident);
 
-			if (method == 1 && strcmp((const char *)trigger_tuple, (const char *)"new") == 0)
-			{
-				/* we need the old value of the pkey for the update */
-				old_pkey_string = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
-				elog(DEBUG2, "tuple: old pkey: %s", old_pkey_string);
+	pfree(query.data);
 
-				/* then skip this tuple */
-				continue;
-			}
-		}
+	SPI_finish();
 
-		if (method == 0)
-		{
-			/* roll forward */
-			elog(DEBUG2, "tuple: %s  %s  %s", trigger_mode, trigger_tuple, trigger_changed);
+	return (Datum) 0;
+}
 
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				__table_log_restore_table_insert(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				__table_log_restore_table_update(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i,
-												 old_pkey_string);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				__table_log_restore_table_delete(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i);
-			}
-			else
-			{
-				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
-			}
+/*
+  table_log_restore_progress()
 
-		}
-		else
-		{
-			/* roll back */
-			char rb_mode[10]; /* reverse the method */
+  show the progress of the restores running in all backends,
+  requires table_log in shared_preload_libraries
 
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				sprintf(rb_mode, "DELETE");
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				sprintf(rb_mode, "UPDATE");
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				sprintf(rb_mode, "INSERT");
-			}
-			else
-			{
-				elog(ERROR, "unknown trigger_mode: %s", trigger_mode);
-			}
+  return:
+    one row for each running restore
+*/
+Datum table_log_restore_progress(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo        *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	TupleDesc             tupdesc;
+	Tuplestorestate      *tupstore;
+	MemoryContext         oldcontext;
+	TableLogProgressSlot *slots;
+	int                   i;
+
+	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
+	{
+		elog(ERROR, "table_log_restore_progress: set-valued function called in context that cannot accept a set");
+	}
+	if (!(rsinfo->allowedModes & SFRM_Materialize))
+	{
+		elog(ERROR, "table_log_restore_progress: materialize mode required, but it is not allowed in this context");
+	}
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+	{
+		elog(ERROR, "table_log_restore_progress: return type must be a row type");
+	}
 
-			elog(DEBUG2, "tuple: %s  %s  %s", rb_mode, trigger_tuple, trigger_changed);
+	/* the result set must survive this call */
+	oldcontext = MemoryContextSwitchTo(rsinfo->econtext->ecxt_per_query_memory);
+	tupdesc    = CreateTupleDescCopy(tupdesc);
+	tupstore   = tuplestore_begin_heap(true, false, work_mem);
+	MemoryContextSwitchTo(oldcontext);
 
-			if (strcmp((const char *)trigger_mode, (const char *)"INSERT") == 0)
-			{
-				__table_log_restore_table_delete(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"UPDATE") == 0)
-			{
-				__table_log_restore_table_update(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i,
-												 old_pkey_string);
-			}
-			else if (strcmp((const char *)trigger_mode, (const char *)"DELETE") == 0)
-			{
-				__table_log_restore_table_insert(spi_tuptable,
-												 (char *)RESTORE_TABLE_IDENT(restore_descr, restore),
-												 list_nth(restore_descr.orig_pk_attr_names, 0),
-												 col_query->data,
-												 col_pkey,
-												 number_columns,
-												 i);
-			}
-		}
-	}
+	rsinfo->returnMode = SFRM_Materialize;
+	rsinfo->setResult  = tupstore;
+	rsinfo->setDesc    = tupdesc;
 
-	/* close SPI connection */
-	SPI_finish();
+	if (tableLogProgress == NULL)
+		return (Datum) 0;
 
-	elog(DEBUG2, "table_log_restore_table() done, results in: %s",
-		 RESTORE_TABLE_IDENT(restore_descr, restore));
+	/* take a copy, so the spinlock is held only briefly */
+	slots = (TableLogProgressSlot *) palloc(sizeof(tableLogProgress->slots));
 
-	/* and return the name of the restore table */
-	PG_RETURN_VARCHAR_P(cstring_to_text(RESTORE_TABLE_IDENT(restore_descr, restore)));
+	SpinLockAcquire(&tableLogProgress->mutex);
+	memcpy(slots, tableLogProgress->slots, sizeof(tableLogProgress->slots));
+	SpinLockRelease(&tableLogProgress->mutex);
+
+	for (i = 0; i < TABLE_LOG_PROGRESS_SLOTS; i++)
+	{
+		Datum values[7];
+		bool  nulls[7];
+
+		if (slots[i].pid == 0)
+			continue;
+
+		/* like pg_stat_progress_*, hide restores of other roles */
+		if (!canSeeRestoreProgress(slots[i].userid))
+			continue;
+
+		memset(nulls, 0, sizeof(nulls));
+
+		values[0] = Int32GetDatum(slots[i].pid);
+		values[1] = ObjectIdGetDatum(slots[i].datid);
+		values[2] = ObjectIdGetDatum(slots[i].relid);
+		values[3] = CStringGetTextDatum(tableLogProgressPhases[slots[i].phase]);
+		values[4] = Int64GetDatum(slots[i].log_rows_total);
+		values[5] = Int64GetDatum(slots[i].log_rows_applied);
+		values[6] = TimestampTzGetDatum(slots[i].started);
+
+		tuplestore_putvalues(tupstore, tupdesc, values, nulls);
+	}
+
+	return (Datum) 0;
 }
 
 static void __table_log_restore_table_insert(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i) {
 	int            j;
@@ -1922,12 +7664,12 @@ static void __table_log_restore_table_insert(SPITupleTable *spi_tuptable,
 
 static void __table_log_restore_table_update(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i,
-											 char *old_pkey_string) {
+											 char **old_pkey_values) {
 	int   j;
 	int   ret;
 	char *tmp;
@@ -1963,10 +7705,21 @@ static void __table_log_restore_table_update(SPITupleTable *spi_tuptable,
 		}
 	}
 
-	appendStringInfo(d_query,
-			 " WHERE %s=%s",
-			 do_quote_ident(table_orig_pkey),
-			 do_quote_literal(old_pkey_string));
+	/*
+	 * Without a preceding image of the row (e.g. when restoring
+	 * a single key which was renamed by this UPDATE) the key of the
+	 * current tuple is the best guess we have.
+	 */
+	if (old_pkey_values == NULL)
+	{
+		old_pkey_values = getPrimaryKeyValues(spi_tuptable,
+											  col_pkeys,
+											  list_length(table_orig_pkeys),
+											  i);
+	}
+
+	appendStringInfoString(d_query, " WHERE ");
+	appendPrimaryKeyPredicate(d_query, table_orig_pkeys, old_pkey_values);
 
 	elog(DEBUG3, "query: %s", d_query->data);
 
@@ -1982,34 +7735,31 @@ static void __table_log_restore_table_update(SPITupleTable *spi_tuptable,
 
 static void __table_log_restore_table_delete(SPITupleTable *spi_tuptable,
 											 char *table_restore,
-											 char *table_orig_pkey,
+											 List *table_orig_pkeys,
 											 char *col_query_start,
-											 int col_pkey,
+											 int *col_pkeys,
 											 int number_columns,
 											 int i) {
-	int   ret;
-	char *tmp;
+	int    ret;
+	char **pkey_values;
 
 	/* memory for dynamic query */
 	StringInfo d_query;
 
-	/* get the size of value */
-	tmp = SPI_getvalue(spi_tuptable->vals[i], spi_tuptable->tupdesc, col_pkey);
-
-	if (tmp == NULL)
-	{
-		elog(ERROR, "pkey cannot be NULL");
-	}
+	/* get the key values, this also checks for NULL */
+	pkey_values = getPrimaryKeyValues(spi_tuptable,
+									  col_pkeys,
+									  list_length(table_orig_pkeys),
+									  i);
 
 	/* initalize StringInfo structure */
 	d_query = makeStringInfo();
 
 	/* build query */
 	appendStringInfo(d_query,
-					 "DELETE FROM %s WHERE %s=%s",
-					 table_restore,
-					 do_quote_ident(table_orig_pkey),
-					 do_quote_literal(tmp));
+					 "DELETE FROM %s WHERE ",
+					 table_restore);
+	appendPrimaryKeyPredicate(d_query, table_orig_pkeys, pkey_values);
 
 	elog(DEBUG3, "query: %s", d_query->data);
 
@@ -2023,6 +7773,188 @@ static void __table_log_restore_table_delete(SPITupleTable *spi_tuptable,
   /* done */
 }
 
+/*
+ * Extracts the values of all primary key columns of the
+ * tuple i from the specified SPI result. col_pkeys holds the
+ * (1-based) column positions of the key columns within the
+ * result.
+ */
+static char **getPrimaryKeyValues(SPITupleTable *spi_tuptable,
+								  int *col_pkeys,
+								  int num_pkeys,
+								  int i)
+{
+	char **pkey_values;
+	int    j;
+
+	pkey_values = (char **) palloc(num_pkeys * sizeof(char *));
+
+	for (j = 0; j < num_pkeys; j++)
+	{
+		pkey_values[j] = SPI_getvalue(spi_tuptable->vals[i],
+									  spi_tuptable->tupdesc,
+									  col_pkeys[j]);
+
+		if (pkey_values[j] == NULL)
+		{
+			elog(ERROR, "pkey cannot be NULL");
+		}
+	}
+
+	return pkey_values;
+}
+
+/*
+ * Splits a primary key string passed to table_log_restore_table()
+ * into the values of the single key columns.
+ *
+ * A single column key is taken verbatim, for compatibility with
+ * older versions. A composite key must be written as a row literal,
+ * e.g. '(1,"foo, bar")', following the same quoting rules as
+ * record_in().
+ */
+static char **splitPrimaryKeyString(char *key_string, int num_pkeys)
+{
+	char         **pkey_values;
+	char          *ptr = key_string;
+	int            j;
+	StringInfoData buf;
+
+	pkey_values = (char **) palloc(num_pkeys * sizeof(char *));
+
+	if (num_pkeys == 1)
+	{
+		pkey_values[0] = key_string;
+		return pkey_values;
+	}
+
+	initStringInfo(&buf);
+
+	while (*ptr && isspace((unsigned char) *ptr))
+		ptr++;
+
+	if (*ptr++ != '(')
+	{
+		elog(ERROR, "malformed composite primary key: \"%s\", expected a row literal",
+			 key_string);
+	}
+
+	for (j = 0; j < num_pkeys; j++)
+	{
+		bool inquote = false;
+		bool quoted  = false;
+
+		resetStringInfo(&buf);
+
+		while (inquote || !(*ptr == ',' || *ptr == ')'))
+		{
+			char ch = *ptr++;
+
+			if (ch == '\0')
+			{
+				elog(ERROR, "malformed composite primary key: \"%s\", unexpected end of input",
+					 key_string);
+			}
+
+			if (ch == '\\')
+			{
+				if (*ptr == '\0')
+				{
+					elog(ERROR, "malformed composite primary key: \"%s\", unexpected end of input",
+						 key_string);
+				}
+
+				appendStringInfoChar(&buf, *ptr++);
+			}
+			else if (ch == '"')
+			{
+				if (!inquote)
+					inquote = quoted = true;
+				else if (*ptr == '"')
+				{
+					/* doubled quote within quote sequence */
+					appendStringInfoChar(&buf, *ptr++);
+				}
+				else
+					inquote = false;
+			}
+			else
+				appendStringInfoChar(&buf, ch);
+		}
+
+		/* an empty field is NULL, "" is an empty string */
+		if (buf.len == 0 && !quoted)
+		{
+			elog(ERROR, "pkey cannot be NULL");
+		}
+
+		pkey_values[j] = pstrdup(buf.data);
+
+		/* the last column must be followed by the closing parenthesis */
+		if (*ptr++ != ((j < num_pkeys - 1) ? ',' : ')'))
+		{
+			elog(ERROR, "malformed composite primary key: \"%s\", expected %d columns",
+				 key_string, num_pkeys);
+		}
+	}
+
+	while (*ptr && isspace((unsigned char) *ptr))
+		ptr++;
+
+	if (*ptr != '\0')
+	{
+		elog(ERROR, "malformed composite primary key: \"%s\", junk after closing parenthesis",
+			 key_string);
+	}
+
+	pfree(buf.data);
+
+	return pkey_values;
+}
+
+/*
+ * Appends a predicate matching the specified primary key values
+ * to buf. Composite keys are compared as a row value, e.g.
+ * (k1, k2) = ('1', 'foo'), which still allows the planner to use
+ * an index on the key columns.
+ */
+static void appendPrimaryKeyPredicate(StringInfo buf,
+									  List *pk_attr_names,
+									  char **pk_values)
+{
+	ListCell *scan;
+	int       num_pkeys = list_length(pk_attr_names);
+	int       j;
+
+	if (num_pkeys > 1)
+		appendStringInfoChar(buf, '(');
+
+	j = 0;
+	foreach(scan, pk_attr_names)
+	{
+		if (j++ > 0)
+			appendStringInfoString(buf, ", ");
+
+		appendStringInfoString(buf, do_quote_ident((char *) lfirst(scan)));
+	}
+
+	if (num_pkeys > 1)
+		appendStringInfoString(buf, ") = (");
+	else
+		appendStringInfoString(buf, " = ");
+
+	for (j = 0; j < num_pkeys; j++)
+	{
+		if (j > 0)
+			appendStringInfoString(buf, ", ");
+
+		appendStringInfoString(buf, do_quote_literal(pk_values[j]));
+	}
+
+	if (num_pkeys > 1)
+		appendStringInfoChar(buf, ')');
+}
+
 static char * do_quote_ident(char *iptr)
 {
 	/* Cast away const ... */
@@ -16,3 +16,40 @@
  * on the current selected partition via table_log.active_partition
  */
 typedef int TableLogPartitionId;
+
+/*
+ * What the trigger functions log of each change: table_log() logs
+ * the old and new images, table_log_basic() only the old images and
+ * table_log_chain() only the new images.
+ */
+#define TABLE_LOG_MODE_FULL  0
+#define TABLE_LOG_MODE_BASIC 1
+#define TABLE_LOG_MODE_CHAIN 2
+
+/*
+ * Export files written by table_log_export() start with this
+ * magic, followed by the format version.
+ */
+#define TABLE_LOG_EXPORT_MAGIC   "TABLELOG"
+#define TABLE_LOG_EXPORT_VERSION 1
+
+/*
+ * Number of restores whose progress can be reported at
+ * the same time, see table_log_restore_progress().
+ */
+#define TABLE_LOG_PROGRESS_SLOTS 64
+
+/*
+ * Number of log entries replayed between two updates of
+ * the progress of a restore.
+ */
+#define TABLE_LOG_PROGRESS_INTERVAL 1000
+
+/*
+ * Phases of a restore reported by table_log_restore_progress().
+ */
+#define TABLE_LOG_PROGRESS_VALIDATING   0
+#define TABLE_LOG_PROGRESS_COPYING_BASE 1
+#define TABLE_LOG_PROGRESS_SCANNING_LOG 2
+#define TABLE_LOG_PROGRESS_REPLAYING    3
+#define TABLE_LOG_PROGRESS_BULK_LOADING 4